@@ -0,0 +1,127 @@
+#include "artifactcache.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QSaveFile>
+
+#include "datasetio.h"
+
+// Bumped whenever the layout of any artifact changes, or what artifacts are
+// computed from does (2: standardization maps constant columns to 0)
+static const char CACHE_VERSION[] = "2";
+
+static const char DIST_MAGIC[8] = { 'P', 'M', 'D', 'I', 'S', 'T', '1', '\0' };
+
+struct DistHeader {
+    char magic[8];
+    uint64_t n;
+    uint64_t elemSize;
+};
+
+ArtifactCache::ArtifactCache()
+{
+}
+
+bool ArtifactCache::open(const QString &cacheDir, const std::string &datasetPath)
+{
+    m_dir.clear();
+
+    QFile file(QString::fromStdString(datasetPath));
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(CACHE_VERSION, sizeof(CACHE_VERSION) - 1);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        return false;
+    }
+
+    QString dir = QDir(cacheDir).filePath(QString(hash.result().toHex()));
+    if (!QDir().mkpath(dir)) {
+        return false;
+    }
+
+    m_dir = dir;
+    return true;
+}
+
+QString ArtifactCache::hashOf(const arma::uvec &v)
+{
+    QByteArray bytes(reinterpret_cast<const char *>(v.memptr()),
+                     int(v.n_elem * sizeof(arma::uword)));
+    return QString(QCryptographicHash::hash(bytes, QCryptographicHash::Sha1).toHex().left(16));
+}
+
+QString ArtifactCache::artifactPath(const QString &name) const
+{
+    return QDir(m_dir).filePath(name);
+}
+
+bool ArtifactCache::load(const QString &name, mp::DistMatrix &D) const
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    QFile file(artifactPath(name));
+    DistHeader header;
+    if (!file.open(QIODevice::ReadOnly)
+        || file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, DIST_MAGIC, sizeof(DIST_MAGIC)) != 0
+        || header.elemSize != sizeof(mp::DistMatrix::elem_type)) {
+        return false;
+    }
+
+    mp::DistMatrix loaded(header.n);
+    qint64 size = loaded.data().n_elem * sizeof(mp::DistMatrix::elem_type);
+    if (file.size() != qint64(sizeof(header)) + size) {
+        return false;
+    }
+
+    if (size > 0
+        && file.read(reinterpret_cast<char *>(loaded.data().memptr()), size) != size) {
+        return false;
+    }
+
+    D = std::move(loaded);
+    return true;
+}
+
+bool ArtifactCache::save(const QString &name, const mp::DistMatrix &D) const
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    DistHeader header;
+    memcpy(header.magic, DIST_MAGIC, sizeof(DIST_MAGIC));
+    header.n = D.size();
+    header.elemSize = sizeof(mp::DistMatrix::elem_type);
+
+    QSaveFile file(artifactPath(name));
+    qint64 size = D.data().n_elem * sizeof(mp::DistMatrix::elem_type);
+    return file.open(QIODevice::WriteOnly)
+        && file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header)
+        && file.write(reinterpret_cast<const char *>(D.data().memptr()), size) == size
+        && file.commit();
+}
+
+std::shared_ptr<arma::mat> ArtifactCache::loadDataset(const QString &name) const
+{
+    QString path = artifactPath(name);
+    if (!isOpen() || !QFile::exists(path)) {
+        return nullptr;
+    }
+
+    return loadBinaryDataset(path.toStdString());
+}
+
+bool ArtifactCache::saveDataset(const QString &name, const arma::mat &X) const
+{
+    if (!isOpen()) {
+        return false;
+    }
+
+    DatasetInfo info;
+    info.standardized = true;
+    return saveBinaryDataset(artifactPath(name).toStdString(), X, info);
+}
@@ -0,0 +1,66 @@
+#ifndef ARTIFACTCACHE_H
+#define ARTIFACTCACHE_H
+
+#include <memory>
+#include <string>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+
+#include <armadillo>
+
+#include "distmatrix.h"
+
+/*
+ * On-disk cache of expensive startup artifacts (the standardized dataset,
+ * generated CPs and their initial map, distance matrices, alphas...). Each
+ * dataset gets its own directory, named after a hash of the dataset file's
+ * contents, so editing the dataset invalidates everything computed from it.
+ * Artifacts are identified by names that must include every parameter used
+ * to compute them (see hashOf() for array parameters).
+ *
+ * A cache which is not open ignores every save and load.
+ */
+class ArtifactCache
+{
+public:
+    ArtifactCache();
+
+    bool open(const QString &cacheDir, const std::string &datasetPath);
+    bool isOpen() const { return !m_dir.isEmpty(); }
+
+    // A short, filename-safe hash of the contents of v
+    static QString hashOf(const arma::uvec &v);
+
+    // Small artifacts use Armadillo's own binary format
+    template<typename T>
+    bool load(const QString &name, T &obj) const {
+        QString path = artifactPath(name);
+        return isOpen() && QFile::exists(path)
+            && obj.load(path.toStdString(), arma::arma_binary);
+    }
+
+    template<typename T>
+    bool save(const QString &name, const T &obj) const {
+        return isOpen()
+            && obj.save(artifactPath(name).toStdString(), arma::arma_binary);
+    }
+
+    // Distance matrices are stored in their packed form, behind a small
+    // header, and read straight into the matrix
+    bool load(const QString &name, mp::DistMatrix &D) const;
+    bool save(const QString &name, const mp::DistMatrix &D) const;
+
+    // Datasets are stored as binary datasets and memory-mapped when loaded
+    // (see loadBinaryDataset())
+    std::shared_ptr<arma::mat> loadDataset(const QString &name) const;
+    bool saveDataset(const QString &name, const arma::mat &X) const;
+
+private:
+    QString artifactPath(const QString &name) const;
+
+    QString m_dir;
+};
+
+#endif // ARTIFACTCACHE_H
@@ -0,0 +1,447 @@
+#include "datasetio.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <QFile>
+#include <QSaveFile>
+
+// Approximate amount of bytes parsed by each task
+static const qint64 CHUNK_SIZE = 4 << 20;
+
+// Longest token handed to strtod() when the fast path cannot handle it
+static const int MAX_TOKEN_LENGTH = 64;
+
+// Binary datasets: header layout and payload alignment. The magic is
+// "PMDATA" plus a version number; files of any version are recognized as
+// binary datasets, but only the current one is read.
+static const char BINARY_MAGIC[8] = { 'P', 'M', 'D', 'A', 'T', 'A', '2', '\0' };
+static const size_t BINARY_MAGIC_PREFIX = 6;
+// Written in the byte order of the writing host; reads back as
+// 0x04030201 on hosts with the opposite byte order
+static const uint32_t BINARY_BYTE_ORDER = 0x01020304;
+static const uint32_t BINARY_HAS_LABELS  = 1 << 0;
+static const uint32_t BINARY_STANDARDIZED = 1 << 1;
+static const uint64_t BINARY_ALIGNMENT = 64;
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t dataType;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t namesSize;  // Column names, each terminated by '\0'
+    uint64_t dataOffset; // From the start of the file
+};
+
+static const double POWERS_OF_TEN[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Largest integer mantissa and power of ten that are exact as doubles
+static const uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 53;
+static const int MAX_EXACT_POWER_OF_TEN = 22;
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static const char *skipSpaces(const char *p, const char *end)
+{
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *lineEnd(const char *p, const char *end)
+{
+    const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    return nl ? nl : end;
+}
+
+// Start of the line after the one ending at e
+static const char *nextLine(const char *e, const char *end)
+{
+    return e < end ? e + 1 : end;
+}
+
+static bool isBlank(const char *p, const char *end)
+{
+    return skipSpaces(p, end) == end;
+}
+
+/*
+ * Parses a number from [p, end) into value, returning a pointer to the first
+ * character after it (or nullptr on failure). Plain decimal numbers whose
+ * mantissa fits in 53 bits (any number with up to 15 significant digits)
+ * and whose exponent is at most 22 in magnitude are computed directly: both
+ * the mantissa and the power of ten are then exact doubles, so the single
+ * multiplication or division rounds correctly and the result matches
+ * strtod(). Anything else (longer mantissas, larger exponents, "nan", "inf",
+ * ...) falls back to strtod().
+ */
+static const char *parseDouble(const char *p, const char *end, double &value)
+{
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool anyDigit = false, truncated = false;
+    for (; p < end && isDigit(*p); p++) {
+        anyDigit = true;
+        if (mantissa == 0 && *p == '0') {
+            continue;
+        }
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+        } else {
+            truncated = true;
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++) {
+            anyDigit = true;
+            if (mantissa == 0 && *p == '0') {
+                exponent--;
+                continue;
+            }
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+                exponent--;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    if (anyDigit && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negativeExp = *q == '-';
+            q++;
+        }
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++) {
+                if (e < 100000) {
+                    e = e * 10 + (*q - '0');
+                }
+            }
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    bool exact = !truncated
+        && mantissa <= MAX_EXACT_MANTISSA
+        && exponent >= -MAX_EXACT_POWER_OF_TEN
+        && exponent <= MAX_EXACT_POWER_OF_TEN;
+    if (anyDigit && exact && (p == end || isSpace(*p) || *p == '\n')) {
+        double v = double(mantissa);
+        if (exponent < 0) {
+            v /= POWERS_OF_TEN[-exponent];
+        } else if (exponent > 0) {
+            v *= POWERS_OF_TEN[exponent];
+        }
+        value = negative ? -v : v;
+        return p;
+    }
+
+    // Slow path: strtod() needs a null-terminated string
+    char token[MAX_TOKEN_LENGTH + 1];
+    const char *tokenEnd = start;
+    while (tokenEnd < end && !isSpace(*tokenEnd) && *tokenEnd != '\n') {
+        tokenEnd++;
+    }
+    if (tokenEnd == start || tokenEnd - start > MAX_TOKEN_LENGTH) {
+        return nullptr;
+    }
+
+    memcpy(token, start, tokenEnd - start);
+    token[tokenEnd - start] = '\0';
+    char *parsedEnd;
+    value = strtod(token, &parsedEnd);
+    if (parsedEnd != token + (tokenEnd - start)) {
+        return nullptr;
+    }
+    return tokenEnd;
+}
+
+// Parses one line into row i of X; returns false if it has the wrong number
+// of columns (or anything that is not a number)
+static bool parseLine(const char *p, const char *end, arma::uword i, arma::mat &X)
+{
+    arma::uword j = 0;
+    p = skipSpaces(p, end);
+    while (p < end) {
+        double value;
+        if (j >= X.n_cols || (p = parseDouble(p, end, value)) == nullptr) {
+            return false;
+        }
+
+        X(i, j++) = value;
+        p = skipSpaces(p, end);
+    }
+
+    return j == X.n_cols;
+}
+
+bool loadTable(const std::string &path, arma::mat &X)
+{
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+        return false;
+    }
+
+    qint64 size = file.size();
+    uchar *mapped = file.map(0, size);
+    if (!mapped) {
+        return false;
+    }
+    const char *data = reinterpret_cast<const char *>(mapped);
+    const char *end = data + size;
+
+    // The first non-blank line tells the number of columns
+    arma::uword numCols = 0;
+    for (const char *p = data; p < end && numCols == 0; ) {
+        const char *e = lineEnd(p, end);
+        for (const char *q = skipSpaces(p, e); q < e; q = skipSpaces(q, e)) {
+            while (q < e && !isSpace(*q)) {
+                q++;
+            }
+            numCols++;
+        }
+        p = nextLine(e, end);
+    }
+    if (numCols == 0) {
+        file.unmap(mapped);
+        return false;
+    }
+
+    // Split the file in chunks at line boundaries
+    int numChunks = int(std::max<qint64>(1, size / CHUNK_SIZE));
+    std::vector<const char *> chunks(numChunks + 1);
+    chunks[0] = data;
+    chunks[numChunks] = end;
+    for (int c = 1; c < numChunks; c++) {
+        const char *p = std::max(data + size * c / numChunks, chunks[c - 1]);
+        chunks[c] = nextLine(lineEnd(p, end), end);
+    }
+
+    // First pass: count rows in each chunk, so each one knows where its rows
+    // go in X
+    std::vector<arma::uword> firstRow(numChunks + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic) shared(chunks, firstRow, numChunks)
+    for (int c = 0; c < numChunks; c++) {
+        arma::uword rows = 0;
+        for (const char *p = chunks[c]; p < chunks[c + 1]; ) {
+            const char *e = lineEnd(p, chunks[c + 1]);
+            if (!isBlank(p, e)) {
+                rows++;
+            }
+            p = nextLine(e, chunks[c + 1]);
+        }
+        firstRow[c + 1] = rows;
+    }
+
+    for (int c = 0; c < numChunks; c++) {
+        firstRow[c + 1] += firstRow[c];
+    }
+
+    // Second pass: parse everything straight into X
+    X.set_size(firstRow[numChunks], numCols);
+    std::vector<char> chunkOk(numChunks, 1);
+
+    #pragma omp parallel for schedule(dynamic) shared(chunks, firstRow, chunkOk, numChunks, X)
+    for (int c = 0; c < numChunks; c++) {
+        arma::uword i = firstRow[c];
+        for (const char *p = chunks[c]; p < chunks[c + 1]; ) {
+            const char *e = lineEnd(p, chunks[c + 1]);
+            if (!isBlank(p, e)) {
+                if (!parseLine(p, e, i++, X)) {
+                    chunkOk[c] = 0;
+                    break;
+                }
+            }
+            p = nextLine(e, chunks[c + 1]);
+        }
+    }
+
+    file.unmap(mapped);
+    return std::find(chunkOk.begin(), chunkOk.end(), 0) == chunkOk.end();
+}
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+}
+
+static uint64_t elementSize(uint32_t dataType)
+{
+    return dataType == BinaryFloat32 ? sizeof(float) : sizeof(double);
+}
+
+static bool readHeader(QFile &file, BinaryHeader &header)
+{
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0
+        || header.byteOrder != BINARY_BYTE_ORDER
+        || (header.dataType != BinaryFloat64 && header.dataType != BinaryFloat32)
+        || header.dataOffset % BINARY_ALIGNMENT != 0
+        || header.dataOffset < sizeof(header) + header.namesSize) {
+        return false;
+    }
+
+    // Everything declared in the header must actually be in the file
+    uint64_t size = elementSize(header.dataType);
+    if (header.cols > 0 && header.rows > UINT64_MAX / header.cols / size) {
+        return false;
+    }
+    uint64_t payloadSize = header.rows * header.cols * size;
+    uint64_t labelsSize = (header.flags & BINARY_HAS_LABELS) ? header.rows * sizeof(double) : 0;
+    return uint64_t(file.size()) >= header.dataOffset + payloadSize + labelsSize;
+}
+
+bool isBinaryDataset(const std::string &path)
+{
+    QFile file(QString::fromStdString(path));
+    char magic[BINARY_MAGIC_PREFIX];
+    return file.open(QIODevice::ReadOnly)
+        && file.read(magic, sizeof(magic)) == sizeof(magic)
+        && memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+std::shared_ptr<arma::mat> loadBinaryDataset(const std::string &path,
+                                             DatasetInfo *info)
+{
+    std::unique_ptr<QFile> file(new QFile(QString::fromStdString(path)));
+    BinaryHeader header;
+    if (!file->open(QIODevice::ReadOnly) || !readHeader(*file, header)) {
+        return nullptr;
+    }
+
+    // A private mapping is copy-on-write: pages are shared with the page
+    // cache until (and unless) someone writes to them
+    uchar *mapped = file->map(0, file->size(), QFileDevice::MapPrivateOption);
+    if (!mapped) {
+        return nullptr;
+    }
+
+    if (info) {
+        const char *names = reinterpret_cast<const char *>(mapped + sizeof(header));
+        const char *namesEnd = names + header.namesSize;
+        info->columnNames.clear();
+        while (names < namesEnd) {
+            const char *e = static_cast<const char *>(memchr(names, '\0', namesEnd - names));
+            e = e ? e : namesEnd;
+            info->columnNames.push_back(std::string(names, e));
+            names = e + 1;
+        }
+
+        if (header.flags & BINARY_HAS_LABELS) {
+            uint64_t labelsOffset = header.dataOffset
+                + header.rows * header.cols * elementSize(header.dataType);
+            info->labels.set_size(header.rows);
+            memcpy(info->labels.memptr(), mapped + labelsOffset, header.rows * sizeof(double));
+        } else {
+            info->labels.reset();
+        }
+
+        info->standardized = (header.flags & BINARY_STANDARDIZED) != 0;
+    }
+
+    uchar *payload = mapped + header.dataOffset;
+    if (header.dataType == BinaryFloat32) {
+        const arma::fmat Xf(reinterpret_cast<float *>(payload),
+                            header.rows, header.cols, false, true);
+        std::shared_ptr<arma::mat> X = std::make_shared<arma::mat>(
+                arma::conv_to<arma::mat>::from(Xf));
+        return X;
+    }
+
+    // Strict auxiliary memory: the matrix can never be resized away from the
+    // mapped pages. The file (and its mapping) is released with the matrix.
+    arma::mat *X = new arma::mat(reinterpret_cast<double *>(payload),
+                                 header.rows, header.cols, false, true);
+    QFile *owner = file.release();
+    return std::shared_ptr<arma::mat>(X, [owner](arma::mat *X) {
+        delete X;
+        delete owner;
+    });
+}
+
+bool saveBinaryDataset(const std::string &path,
+                       const arma::mat &X,
+                       const DatasetInfo &info,
+                       BinaryDataType type)
+{
+    if (info.labels.n_elem > 0 && info.labels.n_elem != X.n_rows) {
+        return false;
+    }
+
+    std::string names;
+    for (const std::string &name : info.columnNames) {
+        names += name;
+        names += '\0';
+    }
+
+    BinaryHeader header;
+    memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    header.byteOrder = BINARY_BYTE_ORDER;
+    header.dataType = type;
+    header.flags = (info.labels.n_elem > 0 ? BINARY_HAS_LABELS : 0)
+                 | (info.standardized ? BINARY_STANDARDIZED : 0);
+    header.reserved = 0;
+    header.rows = X.n_rows;
+    header.cols = X.n_cols;
+    header.namesSize = names.size();
+    header.dataOffset = alignUp(sizeof(header) + names.size());
+
+    QSaveFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    std::vector<char> padding(header.dataOffset - sizeof(header) - names.size(), 0);
+    bool ok = file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header)
+        && file.write(names.data(), names.size()) == qint64(names.size())
+        && file.write(padding.data(), padding.size()) == qint64(padding.size());
+
+    if (type == BinaryFloat32) {
+        arma::fmat Xf = arma::conv_to<arma::fmat>::from(X);
+        qint64 size = Xf.n_elem * sizeof(float);
+        ok = ok && file.write(reinterpret_cast<const char *>(Xf.memptr()), size) == size;
+    } else {
+        qint64 size = X.n_elem * sizeof(double);
+        ok = ok && file.write(reinterpret_cast<const char *>(X.memptr()), size) == size;
+    }
+
+    if (info.labels.n_elem > 0) {
+        qint64 size = info.labels.n_elem * sizeof(double);
+        ok = ok && file.write(reinterpret_cast<const char *>(info.labels.memptr()), size) == size;
+    }
+
+    return ok && file.commit();
+}
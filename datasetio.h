@@ -0,0 +1,65 @@
+#ifndef DATASETIO_H
+#define DATASETIO_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <armadillo>
+
+/*
+ * Loads a text table (as accepted by arma::raw_ascii: one row per line,
+ * columns separated by whitespace) into X. The file is memory-mapped and
+ * parsed by several threads at once, each writing directly into X. Returns
+ * false if the file cannot be read or if any line does not have the same
+ * number of columns as the first one.
+ */
+bool loadTable(const std::string &path, arma::mat &X);
+
+/*
+ * Binary datasets (.pmd) start with a fixed-size header (rows, cols, element
+ * type and flags), followed by the column names, the column-major payload
+ * (aligned to 64 bytes) and, optionally, one float64 label per row. Numbers
+ * are stored in the byte order of the host that wrote the file, which is
+ * tagged in the header; files written with the other byte order are
+ * rejected.
+ */
+enum BinaryDataType {
+    BinaryFloat64 = 0,
+    BinaryFloat32 = 1
+};
+
+struct DatasetInfo {
+    DatasetInfo()
+        : standardized(false)
+    {
+    }
+
+    std::vector<std::string> columnNames;
+    arma::vec labels;
+
+    // Whether columns were already standardized when the file was written
+    bool standardized;
+};
+
+// Whether the file looks like a binary dataset of any format version (it may
+// still be unreadable, e.g., if written by a newer version or on a host with
+// a different byte order)
+bool isBinaryDataset(const std::string &path);
+
+/*
+ * Memory-maps a binary dataset. Float64 payloads are used in place (the
+ * returned matrix points into the mapped pages, which stay mapped for as long
+ * as the matrix lives); float32 payloads are converted. The mapping is
+ * private, so writing to the matrix never changes the file. Returns nullptr
+ * on failure.
+ */
+std::shared_ptr<arma::mat> loadBinaryDataset(const std::string &path,
+                                             DatasetInfo *info = nullptr);
+
+bool saveBinaryDataset(const std::string &path,
+                       const arma::mat &X,
+                       const DatasetInfo &info,
+                       BinaryDataType type = BinaryFloat64);
+
+#endif // DATASETIO_H
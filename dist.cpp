@@ -1,12 +1,101 @@
 #include "mp.h"
 
+#include <algorithm>
+
 #include "utils.h"
 
+// Number of rows of X in each block of the Euclidean kernel; two blocks of X
+// and the resulting block of D should comfortably fit in cache
+static const arma::uword BLOCK_SIZE = 256;
+
 double mp::euclidean(const arma::rowvec &x1, const arma::rowvec &x2)
 {
     return arma::norm(x1 - x2, 2);
 }
 
+arma::mat mp::dist(const arma::mat &X)
+{
+    arma::mat D;
+    mp::dist(X, D);
+    return D;
+}
+
+// Euclidean distances between rows [i0, i1] and rows [j0, j1] of X, where
+// ||xi - xj||^2 = ||xi||^2 + ||xj||^2 - 2 <xi, xj> and the inner products of
+// the whole block come from a single matrix product
+static void euclideanBlock(const arma::mat &X,
+                           const arma::vec &sqNorms,
+                           arma::uword i0, arma::uword i1,
+                           arma::uword j0, arma::uword j1,
+                           arma::mat &block)
+{
+    block = -2. * (X.rows(i0, i1) * X.rows(j0, j1).t());
+    block.each_col() += sqNorms.subvec(i0, i1);
+    block.each_row() += sqNorms.subvec(j0, j1).t();
+
+    // Rounding may leave tiny negative values behind
+    block = arma::sqrt(arma::clamp(block, 0., arma::datum::inf));
+}
+
+void mp::dist(const arma::mat &X, arma::mat &D)
+{
+    arma::uword n = X.n_rows;
+    D.set_size(n, n);
+
+    arma::vec sqNorms = arma::sum(arma::square(X), 1);
+    int numBlocks = uintToInt<arma::uword, int>((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    #pragma omp parallel for schedule(dynamic) shared(X, D, sqNorms, numBlocks)
+    for (int bi = 0; bi < numBlocks; bi++) {
+        arma::uword i0 = bi * BLOCK_SIZE;
+        arma::uword i1 = std::min(i0 + BLOCK_SIZE, n) - 1;
+
+        arma::mat block;
+        for (int bj = 0; bj <= bi; bj++) {
+            arma::uword j0 = bj * BLOCK_SIZE;
+            arma::uword j1 = std::min(j0 + BLOCK_SIZE, n) - 1;
+
+            euclideanBlock(X, sqNorms, i0, i1, j0, j1, block);
+            D.submat(i0, j0, i1, j1) = block;
+            if (bi != bj) {
+                D.submat(j0, i0, j1, i1) = block.t();
+            }
+        }
+    }
+
+    D.diag().zeros();
+}
+
+void mp::dist(const arma::mat &X, mp::DistMatrix &D)
+{
+    arma::uword n = X.n_rows;
+    D.set_size(n);
+
+    arma::vec sqNorms = arma::sum(arma::square(X), 1);
+    int numBlocks = uintToInt<arma::uword, int>((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    #pragma omp parallel for schedule(dynamic) shared(X, D, sqNorms, numBlocks)
+    for (int bi = 0; bi < numBlocks; bi++) {
+        arma::uword i0 = bi * BLOCK_SIZE;
+        arma::uword i1 = std::min(i0 + BLOCK_SIZE, n) - 1;
+
+        arma::mat block;
+        for (int bj = bi; bj < numBlocks; bj++) {
+            arma::uword j0 = bj * BLOCK_SIZE;
+            arma::uword j1 = std::min(j0 + BLOCK_SIZE, n) - 1;
+
+            // Transposed block: column i holds (part of) the packed row i
+            euclideanBlock(X, sqNorms, j0, j1, i0, i1, block);
+            for (arma::uword i = i0; i <= i1; i++) {
+                mp::DistMatrix::elem_type *tail = D.rowTail(i);
+                for (arma::uword j = std::max(j0, i + 1); j <= j1; j++) {
+                    tail[j - i - 1] = block(j - j0, i - i0);
+                }
+            }
+        }
+    }
+}
+
 arma::mat mp::dist(const arma::mat &X, mp::DistFunc dfunc)
 {
     int n = uintToInt<arma::uword, int>(X.n_rows);
@@ -23,3 +112,17 @@ arma::mat mp::dist(const arma::mat &X, mp::DistFunc dfunc)
 
     return D;
 }
+
+void mp::dist(const arma::mat &X, mp::DistMatrix &D, mp::DistFunc dfunc)
+{
+    int n = uintToInt<arma::uword, int>(X.n_rows);
+    D.set_size(n);
+
+    #pragma omp parallel for schedule(dynamic) shared(X, D, n)
+    for (int i = 0; i < n; i++) {
+        mp::DistMatrix::elem_type *tail = D.rowTail(i);
+        for (int j = i + 1; j < n; j++) {
+            tail[j - i - 1] = dfunc(X.row(i), X.row(j));
+        }
+    }
+}
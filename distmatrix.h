@@ -0,0 +1,118 @@
+#ifndef DISTMATRIX_H
+#define DISTMATRIX_H
+
+#include <algorithm>
+#include <utility>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * A symmetric matrix with zeros on its diagonal (such as a distance matrix),
+ * storing only the n * (n - 1) / 2 elements above the diagonal. These are
+ * packed row by row, so the elements (i, j) with j > i are contiguous for
+ * each i. Using float as eT halves memory usage once more.
+ */
+template<typename eT>
+class PackedDistMatrix
+{
+public:
+    typedef eT elem_type;
+
+    PackedDistMatrix()
+        : m_n(0)
+    {
+    }
+
+    explicit PackedDistMatrix(arma::uword n)
+        : m_n(0)
+    {
+        set_size(n);
+    }
+
+    void set_size(arma::uword n) {
+        m_n = n;
+        m_data.set_size(n > 1 ? n * (n - 1) / 2 : 0);
+    }
+
+    arma::uword size() const { return m_n; }
+
+    eT operator()(arma::uword i, arma::uword j) const {
+        if (i == j) {
+            return eT(0);
+        }
+        if (i > j) {
+            std::swap(i, j);
+        }
+
+        return m_data[index(i, j)];
+    }
+
+    // Write access is only allowed above the diagonal (i < j)
+    eT &at(arma::uword i, arma::uword j) { return m_data[index(i, j)]; }
+
+    // Index in the packed storage of element (i, j), with i < j
+    arma::uword index(arma::uword i, arma::uword j) const {
+        return i * (2 * m_n - i - 1) / 2 + (j - i - 1);
+    }
+
+    // Elements (i, i + 1), ..., (i, n - 1) are contiguous from here
+    const eT *rowTail(arma::uword i) const { return m_data.memptr() + index(i, i + 1); }
+    eT *rowTail(arma::uword i) { return m_data.memptr() + index(i, i + 1); }
+
+    // Copies row i (which is the same as column i) into r
+    void row(arma::uword i, arma::vec &r) const {
+        r.set_size(m_n);
+        for (arma::uword j = 0; j < i; j++) {
+            r[j] = m_data[index(j, i)];
+        }
+        r[i] = 0;
+        const eT *tail = rowTail(i);
+        for (arma::uword j = i + 1; j < m_n; j++) {
+            r[j] = tail[j - i - 1];
+        }
+    }
+
+    // Calls f(j, value) for each element (i, j) of row i, j != i
+    template<typename Func>
+    void forEachInRow(arma::uword i, Func f) const {
+        for (arma::uword j = 0; j < i; j++) {
+            f(j, m_data[index(j, i)]);
+        }
+        const eT *tail = rowTail(i);
+        for (arma::uword j = i + 1; j < m_n; j++) {
+            f(j, tail[j - i - 1]);
+        }
+    }
+
+    arma::mat submat(const arma::uvec &rows, const arma::uvec &cols) const {
+        arma::mat S(rows.n_elem, cols.n_elem);
+        for (arma::uword j = 0; j < cols.n_elem; j++) {
+            for (arma::uword i = 0; i < rows.n_elem; i++) {
+                S(i, j) = (*this)(rows[i], cols[j]);
+            }
+        }
+
+        return S;
+    }
+
+    eT max() const { return m_data.n_elem > 0 ? m_data.max() : eT(0); }
+
+    const arma::Col<eT> &data() const { return m_data; }
+    arma::Col<eT> &data() { return m_data; }
+
+private:
+    arma::uword m_n;
+    arma::Col<eT> m_data;
+};
+
+#ifdef MP_FLOAT_DISTANCES
+typedef PackedDistMatrix<float> DistMatrix;
+#else
+typedef PackedDistMatrix<double> DistMatrix;
+#endif
+
+} // namespace mp
+
+#endif // DISTMATRIX_H
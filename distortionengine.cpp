@@ -0,0 +1,397 @@
+#include "distortionengine.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils.h"
+
+// Points per side of each tile; a pair of tiles (X and Y) fits in L2 cache
+static const arma::uword TILE_SIZE = 128;
+
+// The map itself, whose distances are computed when needed
+struct MapCoordinates {
+    const arma::mat &Y;
+};
+
+static bool isContiguous(const arma::uword *indices, arma::uword count)
+{
+    return count == 0 || indices[count - 1] - indices[0] == count - 1;
+}
+
+static void fillTile(const mp::DistMatrix &D,
+                     const arma::uword *rows, arma::uword numRows,
+                     const arma::uword *cols, arma::uword numCols,
+                     double *tile)
+{
+    if (!isContiguous(rows, numRows) || !isContiguous(cols, numCols)) {
+        for (arma::uword r = 0; r < numRows; r++) {
+            for (arma::uword l = 0; l < numCols; l++) {
+                tile[r * numCols + l] = D(rows[r], cols[l]);
+            }
+        }
+        return;
+    }
+
+    // Rows and columns are blocks of the same partition of points, so a tile
+    // is either a diagonal one or entirely on one side of the diagonal
+    // (run() only visits tiles on or above it)
+    arma::uword i0 = rows[0], i1 = rows[0] + numRows;
+    arma::uword j0 = cols[0], j1 = cols[0] + numCols;
+    if (j0 >= i1) {
+        // Above the diagonal: each row is contiguous in packed storage
+        for (arma::uword i = i0; i < i1; i++) {
+            const mp::DistMatrix::elem_type *row = D.rowTail(i) + (j0 - i - 1);
+            std::copy(row, row + numCols, tile + (i - i0) * numCols);
+        }
+    } else if (j1 <= i0) {
+        // Below the diagonal: read the transposed block, also contiguously
+        for (arma::uword j = j0; j < j1; j++) {
+            const mp::DistMatrix::elem_type *row = D.rowTail(j) + (i0 - j - 1);
+            for (arma::uword i = i0; i < i1; i++) {
+                tile[(i - i0) * numCols + (j - j0)] = row[i - i0];
+            }
+        }
+    } else {
+        for (arma::uword i = i0; i < i1; i++) {
+            for (arma::uword j = j0; j < j1; j++) {
+                tile[(i - i0) * numCols + (j - j0)] = D(i, j);
+            }
+        }
+    }
+}
+
+static void fillTile(const arma::mat &D,
+                     const arma::uword *rows, arma::uword numRows,
+                     const arma::uword *cols, arma::uword numCols,
+                     double *tile)
+{
+    for (arma::uword l = 0; l < numCols; l++) {
+        const double *col = D.colptr(cols[l]);
+        for (arma::uword r = 0; r < numRows; r++) {
+            tile[r * numCols + l] = col[rows[r]];
+        }
+    }
+}
+
+static void fillTile(const MapCoordinates &map,
+                     const arma::uword *rows, arma::uword numRows,
+                     const arma::uword *cols, arma::uword numCols,
+                     double *tile)
+{
+    const double *y0 = map.Y.colptr(0);
+    const double *y1 = map.Y.colptr(1);
+    for (arma::uword r = 0; r < numRows; r++) {
+        arma::uword i = rows[r];
+        double *row = tile + r * numCols;
+        for (arma::uword l = 0; l < numCols; l++) {
+            double dx = y0[i] - y0[cols[l]];
+            double dy = y1[i] - y1[cols[l]];
+            row[l] = sqrt(dx*dx + dy*dy);
+        }
+    }
+}
+
+// Largest distance in a map, and the pair of points it is between
+static double maxDistance(const arma::mat &Y, arma::uword &maxA, arma::uword &maxB)
+{
+    int n = uintToInt<arma::uword, int>(Y.n_rows);
+    const double *y0 = Y.colptr(0);
+    const double *y1 = Y.colptr(1);
+    double maxY = 0;
+    maxA = maxB = 0;
+
+    #pragma omp parallel shared(y0, y1, n, maxY, maxA, maxB)
+    {
+        double localMax = 0;
+        arma::uword localA = 0, localB = 0;
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                double dx = y0[i] - y0[j];
+                double dy = y1[i] - y1[j];
+                if (dx*dx + dy*dy > localMax) {
+                    localMax = dx*dx + dy*dy;
+                    localA = i;
+                    localB = j;
+                }
+            }
+        }
+
+        #pragma omp critical
+        if (localMax > maxY) {
+            maxY = localMax;
+            maxA = localA;
+            maxB = localB;
+        }
+    }
+
+    return sqrt(maxY);
+}
+
+DistortionEngine::DistortionEngine()
+{
+}
+
+void DistortionEngine::addMeasure(DistortionMeasure *measure)
+{
+    m_measures.push_back(std::unique_ptr<DistortionMeasure>(measure));
+}
+
+void DistortionEngine::accumulate(const DistortionTile &tile,
+                                  const std::vector<bool> &active,
+                                  std::vector<arma::mat> &sums) const
+{
+    for (arma::uword m = 0; m < m_measures.size(); m++) {
+        if (active[m]) {
+            m_measures[m]->accumulate(tile, sums[m]);
+        }
+    }
+}
+
+void DistortionEngine::finish(const std::vector<arma::mat> &sums,
+                              const std::vector<bool> &active,
+                              arma::uword n,
+                              arma::mat &values) const
+{
+    values.set_size(n, m_measures.size());
+    for (arma::uword m = 0; m < m_measures.size(); m++) {
+        if (!active[m]) {
+            values.col(m).fill(arma::datum::nan);
+            continue;
+        }
+
+        arma::vec v;
+        m_measures[m]->finish(sums[m], v);
+        values.col(m) = v;
+    }
+}
+
+template<typename SourceX, typename SourceY>
+void DistortionEngine::runKernel(const SourceX &sourceX,
+                                 const SourceY &sourceY,
+                                 arma::uword n,
+                                 const std::vector<bool> &active,
+                                 double maxX,
+                                 double maxY,
+                                 std::vector<arma::mat> &sums) const
+{
+    sums.resize(m_measures.size());
+    for (arma::uword m = 0; m < m_measures.size(); m++) {
+        if (active[m]) {
+            sums[m].zeros(m_measures[m]->numSums(), n);
+        } else {
+            sums[m].reset();
+        }
+    }
+    if (n == 0 || std::find(active.begin(), active.end(), true) == active.end()) {
+        return;
+    }
+
+    // Each unordered pair of tiles (a, b), a <= b, is visited once, in round
+    // (a + b) mod numTiles. Every tile is in exactly one pair of each round, so
+    // the pairs of a round can be accumulated in parallel (into the sums of
+    // both tiles) without two threads ever updating the same point.
+    arma::uvec indices = arma::regspace<arma::uvec>(0, n - 1);
+    arma::uword numTiles = (n + TILE_SIZE - 1) / TILE_SIZE;
+    int numTilesInt = uintToInt<arma::uword, int>(numTiles);
+
+    #pragma omp parallel shared(sourceX, sourceY, active, sums, indices, maxX, maxY, numTiles, numTilesInt)
+    {
+        std::vector<double> tileX(TILE_SIZE * TILE_SIZE);
+        std::vector<double> tileY(TILE_SIZE * TILE_SIZE);
+
+        for (arma::uword round = 0; round < numTiles; round++) {
+            #pragma omp for schedule(dynamic)
+            for (int a = 0; a < numTilesInt; a++) {
+                arma::uword b = (round + numTiles - a) % numTiles;
+                if (b < arma::uword(a)) {
+                    continue;
+                }
+
+                arma::uword i0 = a * TILE_SIZE;
+                arma::uword j0 = b * TILE_SIZE;
+                arma::uword numRows = std::min(TILE_SIZE, n - i0);
+                arma::uword numCols = std::min(TILE_SIZE, n - j0);
+                const arma::uword *rows = indices.memptr() + i0;
+                const arma::uword *cols = indices.memptr() + j0;
+                fillTile(sourceX, rows, numRows, cols, numCols, tileX.data());
+                fillTile(sourceY, rows, numRows, cols, numCols, tileY.data());
+
+                // Diagonal tiles hold both (i, j) and (j, i)
+                DistortionTile tile = { rows, cols, numRows, numCols,
+                                        tileX.data(), tileY.data(),
+                                        maxX, maxY, 1.0, b != arma::uword(a) };
+                accumulate(tile, active, sums);
+            }
+        }
+    }
+}
+
+void DistortionEngine::run(const mp::DistMatrix &distX,
+                           const arma::mat &Y,
+                           const std::vector<bool> &active,
+                           arma::mat &values,
+                           double maxX,
+                           DistortionState *state) const
+{
+    DistortionState local;
+    DistortionState &s = state ? *state : local;
+    s.maxY = 0;
+    s.maxA = s.maxB = 0;
+
+    bool any = std::find(active.begin(), active.end(), true) != active.end();
+    if (any) {
+        if (maxX < 0) {
+            maxX = distX.max();
+        }
+        s.maxY = maxDistance(Y, s.maxA, s.maxB);
+    }
+
+    MapCoordinates map = { Y };
+    runKernel(distX, map, Y.n_rows, active, maxX, s.maxY, s.sums);
+    finish(s.sums, active, Y.n_rows, values);
+}
+
+void DistortionEngine::run(const arma::mat &distX,
+                           const arma::mat &distY,
+                           arma::mat &values) const
+{
+    std::vector<bool> active(m_measures.size(), true);
+    std::vector<arma::mat> sums;
+    runKernel(distX, distY, distX.n_rows, active, distX.max(), distY.max(), sums);
+    finish(sums, active, distX.n_rows, values);
+}
+
+bool DistortionEngine::update(const mp::DistMatrix &distX,
+                              const arma::mat &prevY,
+                              const arma::mat &Y,
+                              const arma::uvec &changedRows,
+                              const std::vector<bool> &active,
+                              arma::mat &values,
+                              double maxX,
+                              DistortionState &state) const
+{
+    arma::uword n = Y.n_rows;
+    if (state.sums.size() != m_measures.size()
+        || prevY.n_rows != n
+        || n == 0) {
+        return false;
+    }
+    for (arma::uword m = 0; m < m_measures.size(); m++) {
+        if (active[m] && state.sums[m].n_cols != n) {
+            return false;
+        }
+    }
+
+    if (maxX < 0) {
+        maxX = distX.max();
+    }
+
+    // Every term depends on the largest distance in the map. It is only known
+    // to be the same if its pair of points did not move and no moved point is
+    // now farther from any other.
+    std::vector<bool> changed(n, false);
+    for (arma::uword c : changedRows) {
+        changed[c] = true;
+    }
+    if (changed[state.maxA] || changed[state.maxB]) {
+        return false;
+    }
+
+    const double *y0 = Y.colptr(0);
+    const double *y1 = Y.colptr(1);
+    double maxY2 = state.maxY * state.maxY;
+    int numChanged = uintToInt<arma::uword, int>(changedRows.n_elem);
+    bool maxChanged = false;
+
+    #pragma omp parallel for shared(changedRows, y0, y1, maxY2, numChanged) reduction(||:maxChanged)
+    for (int l = 0; l < numChanged; l++) {
+        arma::uword c = changedRows[l];
+        for (arma::uword j = 0; j < n; j++) {
+            double dx = y0[c] - y0[j];
+            double dy = y1[c] - y1[j];
+            maxChanged = maxChanged || (dx*dx + dy*dy > maxY2);
+        }
+    }
+    if (maxChanged) {
+        return false;
+    }
+
+    arma::uvec indices = arma::regspace<arma::uvec>(0, n - 1);
+    arma::uword numTiles = (n + TILE_SIZE - 1) / TILE_SIZE;
+    arma::uword numChangedTiles = (changedRows.n_elem + TILE_SIZE - 1) / TILE_SIZE;
+    int numRowTiles = uintToInt<arma::uword, int>(numTiles);
+    int numChangedRowTiles = uintToInt<arma::uword, int>(numChangedTiles);
+    MapCoordinates prevMap = { prevY }, map = { Y };
+    double maxY = state.maxY;
+    std::vector<arma::mat> &sums = state.sums;
+
+    // Pairs with a moved point: take out what they added before and add what
+    // they add now. Moved points themselves are recomputed below.
+    #pragma omp parallel shared(distX, prevMap, map, active, sums, indices, changedRows, maxX, maxY, numChangedTiles, numRowTiles)
+    {
+        std::vector<double> tileX(TILE_SIZE * TILE_SIZE);
+        std::vector<double> tileY(TILE_SIZE * TILE_SIZE);
+
+        #pragma omp for schedule(dynamic)
+        for (int bi = 0; bi < numRowTiles; bi++) {
+            arma::uword i0 = bi * TILE_SIZE;
+            arma::uword numRows = std::min(TILE_SIZE, n - i0);
+            const arma::uword *rows = indices.memptr() + i0;
+            for (arma::uword bj = 0; bj < numChangedTiles; bj++) {
+                arma::uword j0 = bj * TILE_SIZE;
+                arma::uword numCols = std::min(TILE_SIZE, changedRows.n_elem - j0);
+                const arma::uword *cols = changedRows.memptr() + j0;
+                fillTile(distX, rows, numRows, cols, numCols, tileX.data());
+
+                fillTile(prevMap, rows, numRows, cols, numCols, tileY.data());
+                DistortionTile tile = { rows, cols, numRows, numCols,
+                                        tileX.data(), tileY.data(),
+                                        maxX, maxY, -1.0, false };
+                accumulate(tile, active, sums);
+
+                fillTile(map, rows, numRows, cols, numCols, tileY.data());
+                tile.weight = 1.0;
+                accumulate(tile, active, sums);
+            }
+        }
+    }
+
+    for (arma::uword m = 0; m < sums.size(); m++) {
+        if (!active[m]) {
+            continue;
+        }
+        for (arma::uword c : changedRows) {
+            sums[m].col(c).zeros();
+        }
+    }
+
+    #pragma omp parallel shared(distX, map, active, sums, indices, changedRows, maxX, maxY, numTiles, numChangedRowTiles)
+    {
+        std::vector<double> tileX(TILE_SIZE * TILE_SIZE);
+        std::vector<double> tileY(TILE_SIZE * TILE_SIZE);
+
+        #pragma omp for schedule(dynamic)
+        for (int bi = 0; bi < numChangedRowTiles; bi++) {
+            arma::uword i0 = bi * TILE_SIZE;
+            arma::uword numRows = std::min(TILE_SIZE, changedRows.n_elem - i0);
+            const arma::uword *rows = changedRows.memptr() + i0;
+            for (arma::uword bj = 0; bj < numTiles; bj++) {
+                arma::uword j0 = bj * TILE_SIZE;
+                arma::uword numCols = std::min(TILE_SIZE, n - j0);
+                const arma::uword *cols = indices.memptr() + j0;
+                fillTile(distX, rows, numRows, cols, numCols, tileX.data());
+                fillTile(map, rows, numRows, cols, numCols, tileY.data());
+
+                DistortionTile tile = { rows, cols, numRows, numCols,
+                                        tileX.data(), tileY.data(),
+                                        maxX, maxY, 1.0, false };
+                accumulate(tile, active, sums);
+            }
+        }
+    }
+
+    finish(sums, active, n, values);
+    return true;
+}
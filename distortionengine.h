@@ -0,0 +1,93 @@
+#ifndef DISTORTIONENGINE_H
+#define DISTORTIONENGINE_H
+
+#include <memory>
+#include <vector>
+
+#include <armadillo>
+
+#include "distmatrix.h"
+#include "distortionmeasure.h"
+
+/*
+ * What the engine needs to update the measures of a map when only some of its
+ * points move: the running sums of every measure computed (those of other
+ * measures are empty) and the largest distance in the map (between points
+ * maxA and maxB).
+ */
+struct DistortionState {
+    std::vector<arma::mat> sums;
+    double maxY;
+    arma::uword maxA, maxB;
+};
+
+/*
+ * Computes several distortion measures at once. Each unordered pair of
+ * points is visited a single time, in tiles: each tile of distances is read
+ * (or, for maps, computed) once and handed to every measure, so adding
+ * measures adds arithmetic but no memory traffic. Only the measures flagged
+ * in active are computed; column m of values holds the values of the m-th
+ * measure added, or NaN if it was not computed.
+ */
+class DistortionEngine
+{
+public:
+    DistortionEngine();
+
+    void addMeasure(DistortionMeasure *measure);
+
+    arma::uword numMeasures() const { return m_measures.size(); }
+    const DistortionMeasure &measure(arma::uword m) const { return *m_measures[m]; }
+
+    // Distances in the map are computed from Y as needed; maxX (the largest
+    // value in distX) is computed if not given. If state is given, it is
+    // filled for later calls to update().
+    void run(const mp::DistMatrix &distX,
+             const arma::mat &Y,
+             const std::vector<bool> &active,
+             arma::mat &values,
+             double maxX = -1,
+             DistortionState *state = nullptr) const;
+
+    // Computes every measure
+    void run(const arma::mat &distX,
+             const arma::mat &distY,
+             arma::mat &values) const;
+
+    // Updates state (left by run() or update() on prevY) and values for Y,
+    // which only differs from prevY in changedRows. This is O(n |changedRows|)
+    // instead of O(n^2). Returns false, changing nothing, if that is not
+    // possible: when the largest distance in the map changes, every term has
+    // to be renormalized, and when state lacks the sums of an active measure;
+    // run() must be used instead.
+    bool update(const mp::DistMatrix &distX,
+                const arma::mat &prevY,
+                const arma::mat &Y,
+                const arma::uvec &changedRows,
+                const std::vector<bool> &active,
+                arma::mat &values,
+                double maxX,
+                DistortionState &state) const;
+
+private:
+    template<typename SourceX, typename SourceY>
+    void runKernel(const SourceX &sourceX,
+                   const SourceY &sourceY,
+                   arma::uword n,
+                   const std::vector<bool> &active,
+                   double maxX,
+                   double maxY,
+                   std::vector<arma::mat> &sums) const;
+
+    void accumulate(const DistortionTile &tile,
+                    const std::vector<bool> &active,
+                    std::vector<arma::mat> &sums) const;
+    void finish(const std::vector<arma::mat> &sums,
+                const std::vector<bool> &active,
+                arma::uword n,
+                arma::mat &values) const;
+
+    std::vector<std::unique_ptr<DistortionMeasure>> m_measures;
+};
+
+#endif // DISTORTIONENGINE_H
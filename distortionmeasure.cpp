@@ -0,0 +1,201 @@
+#include "distortionmeasure.h"
+
+#include <cmath>
+
+#include "utils.h"
+
+// Differences smaller than this are considered noise (see mp::aggregatedError)
+static const double EPSILON = 1e-6;
+
+arma::vec DistortionMeasure::measure(const arma::mat &distA, const arma::mat &distB) const
+{
+    arma::uword n = distA.n_rows;
+    arma::mat sums(numSums(), n, arma::fill::zeros);
+    arma::uvec indices = arma::regspace<arma::uvec>(0, n - 1);
+    double maxA = distA.max();
+    double maxB = distB.max();
+
+    // Distance matrices are symmetric: column i is row i, which already is a
+    // (single row) tile
+    int numPoints = uintToInt<arma::uword, int>(n);
+
+    #pragma omp parallel for shared(distA, distB, sums, indices, maxA, maxB, n, numPoints)
+    for (int i = 0; i < numPoints; i++) {
+        DistortionTile tile = { indices.memptr() + i, indices.memptr(), 1, n,
+                                distA.colptr(i), distB.colptr(i),
+                                maxA, maxB, 1.0, false };
+        accumulate(tile, sums);
+    }
+
+    arma::vec v;
+    finish(sums, v);
+    return v;
+}
+
+void AggregatedErrorMeasure::accumulate(const DistortionTile &tile, arma::mat &sums) const
+{
+    for (arma::uword r = 0; r < tile.numRows; r++) {
+        arma::uword i = tile.rows[r];
+        const double *dX = tile.distX + r * tile.numCols;
+        const double *dY = tile.distY + r * tile.numCols;
+        double sum = 0;
+        for (arma::uword l = 0; l < tile.numCols; l++) {
+            if (tile.cols[l] == i) {
+                continue;
+            }
+
+            double diff = fabs(dY[l] / tile.maxY - dX[l] / tile.maxX);
+            if (diff >= EPSILON) {
+                sum += diff;
+                if (tile.mirrored) {
+                    sums(0, tile.cols[l]) += tile.weight * diff;
+                }
+            }
+        }
+
+        sums(0, i) += tile.weight * sum;
+    }
+}
+
+void AggregatedErrorMeasure::finish(const arma::mat &sums, arma::vec &v) const
+{
+    v = sums.row(0).t();
+}
+
+void NormalizedStressMeasure::accumulate(const DistortionTile &tile, arma::mat &sums) const
+{
+    for (arma::uword r = 0; r < tile.numRows; r++) {
+        arma::uword i = tile.rows[r];
+        const double *dX = tile.distX + r * tile.numCols;
+        const double *dY = tile.distY + r * tile.numCols;
+        double residual = 0, total = 0;
+        for (arma::uword l = 0; l < tile.numCols; l++) {
+            double x = dX[l] / tile.maxX;
+            double y = dY[l] / tile.maxY;
+            residual += (x - y) * (x - y);
+            total += x * x;
+            if (tile.mirrored) {
+                double *pair = sums.colptr(tile.cols[l]);
+                pair[0] += tile.weight * (x - y) * (x - y);
+                pair[1] += tile.weight * x * x;
+            }
+        }
+
+        // Pairs (i, i) are zero on both sides and add nothing
+        sums(0, i) += tile.weight * residual;
+        sums(1, i) += tile.weight * total;
+    }
+}
+
+void NormalizedStressMeasure::finish(const arma::mat &sums, arma::vec &v) const
+{
+    v.set_size(sums.n_cols);
+    for (arma::uword i = 0; i < sums.n_cols; i++) {
+        v[i] = sums(1, i) > 0 ? sums(0, i) / sums(1, i) : 0;
+    }
+}
+
+void ShepardResidualMeasure::accumulate(const DistortionTile &tile, arma::mat &sums) const
+{
+    for (arma::uword r = 0; r < tile.numRows; r++) {
+        arma::uword i = tile.rows[r];
+        const double *dX = tile.distX + r * tile.numCols;
+        const double *dY = tile.distY + r * tile.numCols;
+        double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+        for (arma::uword l = 0; l < tile.numCols; l++) {
+            if (tile.cols[l] == i) {
+                continue;
+            }
+
+            // Normalized, so that sums do not grow too large
+            double x = dX[l] / tile.maxX;
+            double y = dY[l] / tile.maxY;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            syy += y * y;
+            sxy += x * y;
+            if (tile.mirrored) {
+                double *pair = sums.colptr(tile.cols[l]);
+                pair[0] += tile.weight * x;
+                pair[1] += tile.weight * y;
+                pair[2] += tile.weight * x * x;
+                pair[3] += tile.weight * y * y;
+                pair[4] += tile.weight * x * y;
+            }
+        }
+
+        sums(0, i) += tile.weight * sx;
+        sums(1, i) += tile.weight * sy;
+        sums(2, i) += tile.weight * sxx;
+        sums(3, i) += tile.weight * syy;
+        sums(4, i) += tile.weight * sxy;
+    }
+}
+
+void ShepardResidualMeasure::finish(const arma::mat &sums, arma::vec &v) const
+{
+    // Every point is paired with all others
+    double m = double(sums.n_cols) - 1;
+    v.set_size(sums.n_cols);
+    for (arma::uword i = 0; i < sums.n_cols; i++) {
+        double sx = sums(0, i), sy = sums(1, i);
+        double cov = sums(4, i) - sx * sy / m;
+        double varX = sums(2, i) - sx * sx / m;
+        double varY = sums(3, i) - sy * sy / m;
+        double den = sqrt(varX * varY);
+        v[i] = den > 0 ? 1 - cov / den : 0;
+    }
+}
+
+KLDivergenceMeasure::KLDivergenceMeasure(double sigma)
+    : m_sigma(sigma)
+{
+}
+
+void KLDivergenceMeasure::accumulate(const DistortionTile &tile, arma::mat &sums) const
+{
+    // With p ~ exp(-a) and q ~ exp(-b), KL(P || Q) only needs both normalizing
+    // constants and the sum of exp(-a) (b - a); see finish()
+    double scale = 1.0 / (2 * m_sigma * m_sigma);
+    for (arma::uword r = 0; r < tile.numRows; r++) {
+        arma::uword i = tile.rows[r];
+        const double *dX = tile.distX + r * tile.numCols;
+        const double *dY = tile.distY + r * tile.numCols;
+        double zP = 0, zQ = 0, s = 0;
+        for (arma::uword l = 0; l < tile.numCols; l++) {
+            if (tile.cols[l] == i) {
+                continue;
+            }
+
+            double x = dX[l] / tile.maxX;
+            double y = dY[l] / tile.maxY;
+            double a = x * x * scale;
+            double b = y * y * scale;
+            double p = exp(-a);
+            double q = exp(-b);
+            zP += p;
+            zQ += q;
+            s += p * (b - a);
+            if (tile.mirrored) {
+                double *pair = sums.colptr(tile.cols[l]);
+                pair[0] += tile.weight * p;
+                pair[1] += tile.weight * q;
+                pair[2] += tile.weight * p * (b - a);
+            }
+        }
+
+        sums(0, i) += tile.weight * zP;
+        sums(1, i) += tile.weight * zQ;
+        sums(2, i) += tile.weight * s;
+    }
+}
+
+void KLDivergenceMeasure::finish(const arma::mat &sums, arma::vec &v) const
+{
+    v.set_size(sums.n_cols);
+    for (arma::uword i = 0; i < sums.n_cols; i++) {
+        double zP = sums(0, i), zQ = sums(1, i);
+        v[i] = (zP > 0 && zQ > 0) ? sums(2, i) / zP - log(zP) + log(zQ) : 0;
+    }
+}
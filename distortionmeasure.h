@@ -1,12 +1,106 @@
 #ifndef DISTORTIONMEASURE_H
 #define DISTORTIONMEASURE_H
 
+#include <string>
+
 #include <armadillo>
 
+/*
+ * A block of pairwise distances, in both the original space (distX) and the
+ * map (distY), between points rows[0..numRows) and cols[0..numCols). Both
+ * blocks are stored row by row: the distances of point rows[r] are at
+ * r * numCols. Pairs of a point with itself may appear and must be skipped.
+ * maxX and maxY are the largest distances in each space, for measures that
+ * need them normalized. Contributions of the tile are multiplied by weight,
+ * which is -1 when the engine removes the contributions of outdated pairs.
+ * When mirrored is set, the engine visits each pair only once (the tile
+ * stands for its transpose as well), so what each pair adds to the sums of
+ * rows[r] must also be added to the sums of cols[l].
+ */
+struct DistortionTile {
+    const arma::uword *rows, *cols;
+    arma::uword numRows, numCols;
+    const double *distX, *distY;
+    double maxX, maxY;
+    double weight;
+    bool mirrored;
+};
+
+/*
+ * A per-point measure of how much a map distorts the original distances.
+ * Measures are computed by DistortionEngine, which streams tiles over all
+ * pairs; each measure keeps numSums() running sums per point (a column of
+ * sums for each point) and turns them into values in the end. What a pair
+ * adds to the sums of either of its points must only depend on the pair's
+ * distances, so that the engine can visit each pair once. Tiles sharing
+ * rows or columns are never accumulated concurrently. As sums are additive
+ * over pairs, the engine can also update them when only a few points move.
+ */
 class DistortionMeasure
 {
 public:
-    virtual arma::vec measure(const arma::mat &distA, const arma::mat &distB) = 0;
+    virtual ~DistortionMeasure() {}
+
+    virtual std::string name() const = 0;
+    virtual arma::uword numSums() const = 0;
+
+    virtual void accumulate(const DistortionTile &tile, arma::mat &sums) const = 0;
+    virtual void finish(const arma::mat &sums, arma::vec &v) const = 0;
+
+    // Convenience for computing this measure alone, from two distance matrices
+    arma::vec measure(const arma::mat &distA, const arma::mat &distB) const;
+};
+
+// Sum of absolute differences of normalized distances (see mp::aggregatedError)
+class AggregatedErrorMeasure
+    : public DistortionMeasure
+{
+public:
+    std::string name() const { return "Aggregated error"; }
+    arma::uword numSums() const { return 1; }
+    void accumulate(const DistortionTile &tile, arma::mat &sums) const;
+    void finish(const arma::mat &sums, arma::vec &v) const;
+};
+
+// Stress of each point's distances: sum of squared differences of normalized
+// distances over the sum of squared (normalized) original distances
+class NormalizedStressMeasure
+    : public DistortionMeasure
+{
+public:
+    std::string name() const { return "Normalized stress"; }
+    arma::uword numSums() const { return 2; }
+    void accumulate(const DistortionTile &tile, arma::mat &sums) const;
+    void finish(const arma::mat &sums, arma::vec &v) const;
+};
+
+// 1 - the Pearson correlation between each point's original and mapped
+// distances (its row of the Shepard diagram)
+class ShepardResidualMeasure
+    : public DistortionMeasure
+{
+public:
+    std::string name() const { return "Shepard residual"; }
+    arma::uword numSums() const { return 5; }
+    void accumulate(const DistortionTile &tile, arma::mat &sums) const;
+    void finish(const arma::mat &sums, arma::vec &v) const;
+};
+
+// KL divergence between each point's neighborhood distributions in both
+// spaces, given by Gaussian kernels (of width sigma) on normalized distances
+class KLDivergenceMeasure
+    : public DistortionMeasure
+{
+public:
+    KLDivergenceMeasure(double sigma = 0.1);
+
+    std::string name() const { return "KL divergence"; }
+    arma::uword numSums() const { return 3; }
+    void accumulate(const DistortionTile &tile, arma::mat &sums) const;
+    void finish(const arma::mat &sums, arma::vec &v) const;
+
+private:
+    double m_sigma;
 };
 
 #endif // DISTORTIONMEASURE_H
@@ -1,7 +1,13 @@
 #include "mp.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <limits>
+#include <random>
+#include <vector>
+
+#include "utils.h"
 
 static const double EPSILON = 1e-3;
 
@@ -45,3 +51,96 @@ arma::mat mp::forceScheme(const arma::mat &D,
 
     return Y;
 }
+
+// Points moved by the same thread are processed in blocks of this size; each
+// block has its own RNG, seeded from the block index and iteration, so
+// results depend neither on the number of threads nor on scheduling
+static const arma::uword BLOCK_SIZE = 256;
+
+arma::mat mp::parallelForceScheme(const arma::mat &D,
+        arma::mat &Y,
+        size_t maxIter,
+        double tol,
+        double fraction,
+        unsigned int seed)
+{
+    // Positions are packed as (x, y) pairs below
+    assert(Y.n_cols == 2);
+    assert(D.n_rows == Y.n_rows && D.n_cols == Y.n_rows);
+
+    arma::uword n = Y.n_rows;
+    arma::uword numBlocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Positions as (x, y) pairs; pivots are read from the snapshot taken at
+    // the start of each iteration, so each point is only written to by the
+    // thread that owns it
+    std::vector<float> pos(2 * n), snapshot(2 * n);
+    for (arma::uword i = 0; i < n; i++) {
+        pos[2*i]     = float(Y(i, 0));
+        pos[2*i + 1] = float(Y(i, 1));
+    }
+
+    std::vector<double> blockDeltaSums(numBlocks);
+    int numBlocksInt = uintToInt<arma::uword, int>(numBlocks);
+
+    double prevDeltaSum = std::numeric_limits<double>::infinity();
+    for (size_t iter = 0; iter < maxIter; iter++) {
+        snapshot = pos;
+
+        #pragma omp parallel shared(D, pos, snapshot, blockDeltaSums, n, numBlocksInt, iter, fraction, seed)
+        {
+            std::vector<arma::uword> pivots(n);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int b = 0; b < numBlocksInt; b++) {
+                std::seed_seq seeds{seed, unsigned(iter), unsigned(b)};
+                std::mt19937 rng(seeds);
+                for (arma::uword i = 0; i < n; i++) {
+                    pivots[i] = i;
+                }
+                std::shuffle(pivots.begin(), pivots.end(), rng);
+
+                double deltaSum = 0;
+                arma::uword end = std::min(n, (b + 1) * BLOCK_SIZE);
+                for (arma::uword j = b * BLOCK_SIZE; j < end; j++) {
+                    float xj = pos[2*j], yj = pos[2*j + 1];
+                    const double *Dj = D.colptr(j);
+                    for (auto i: pivots) {
+                        if (i == j) {
+                            continue;
+                        }
+
+                        float dx = xj - snapshot[2*i];
+                        float dy = yj - snapshot[2*i + 1];
+                        float d2 = std::max(std::sqrt(dx*dx + dy*dy), float(EPSILON));
+                        float delta = float((Dj[i] - d2) / fraction);
+                        deltaSum += std::fabs(delta);
+                        xj += delta * (dx / d2);
+                        yj += delta * (dy / d2);
+                    }
+                    pos[2*j]     = xj;
+                    pos[2*j + 1] = yj;
+                }
+                blockDeltaSums[b] = deltaSum;
+            }
+        }
+
+        // Summed in block order, so the stopping criterion is deterministic
+        double deltaSum = 0;
+        for (auto blockDeltaSum: blockDeltaSums) {
+            deltaSum += blockDeltaSum;
+        }
+
+        if (fabs(prevDeltaSum - deltaSum) < tol) {
+            break;
+        }
+        prevDeltaSum = deltaSum;
+    }
+
+    for (arma::uword i = 0; i < n; i++) {
+        Y(i, 0) = pos[2*i];
+        Y(i, 1) = pos[2*i + 1];
+    }
+
+    return Y;
+}
@@ -0,0 +1,190 @@
+#include "grid2d.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils.h"
+
+// Average number of points in each cell
+static const double POINTS_PER_CELL = 2.0;
+
+mp::Grid2D::Grid2D()
+    : m_minX(0)
+    , m_minY(0)
+    , m_cellSize(1)
+    , m_cols(0)
+    , m_rows(0)
+{
+}
+
+mp::Grid2D::Grid2D(const arma::mat &Y)
+{
+    build(Y);
+}
+
+void mp::Grid2D::build(const arma::mat &Y)
+{
+    arma::uword n = Y.n_rows;
+    m_points.resize(n);
+    if (n == 0) {
+        m_minX = m_minY = 0;
+        m_cellSize = 1;
+        m_cols = m_rows = 0;
+        m_cellStart.assign(1, 0);
+        return;
+    }
+
+    const double *y0 = Y.colptr(0);
+    const double *y1 = Y.colptr(1);
+    m_minX = *std::min_element(y0, y0 + n);
+    m_minY = *std::min_element(y1, y1 + n);
+    double width  = *std::max_element(y0, y0 + n) - m_minX;
+    double height = *std::max_element(y1, y1 + n) - m_minY;
+
+    // Square cells, sized for POINTS_PER_CELL points on average; very thin
+    // maps are limited to about n / POINTS_PER_CELL cells along each axis
+    double maxCells = std::max(1.0, n / POINTS_PER_CELL);
+    m_cellSize = std::max(sqrt(width * height / maxCells),
+                          std::max(width, height) / maxCells);
+    if (m_cellSize <= 0) {
+        m_cellSize = 1;
+    }
+    m_cols = arma::uword(width / m_cellSize) + 1;
+    m_rows = arma::uword(height / m_cellSize) + 1;
+
+    // Counting sort of points by cell
+    std::vector<arma::uword> cells(n);
+    m_cellStart.assign(m_cols * m_rows + 1, 0);
+    for (arma::uword i = 0; i < n; i++) {
+        cells[i] = cellY(y1[i]) * m_cols + cellX(y0[i]);
+        m_cellStart[cells[i] + 1]++;
+    }
+    for (arma::uword c = 0; c < m_cols * m_rows; c++) {
+        m_cellStart[c + 1] += m_cellStart[c];
+    }
+
+    std::vector<arma::uword> next(m_cellStart.begin(), m_cellStart.end() - 1);
+    for (arma::uword i = 0; i < n; i++) {
+        Point p = { y0[i], y1[i], i };
+        m_points[next[cells[i]]++] = p;
+    }
+}
+
+arma::uword mp::Grid2D::cellX(double x) const
+{
+    double c = floor((x - m_minX) / m_cellSize);
+    return c <= 0 ? 0 : std::min(arma::uword(c), m_cols - 1);
+}
+
+arma::uword mp::Grid2D::cellY(double y) const
+{
+    double c = floor((y - m_minY) / m_cellSize);
+    return c <= 0 ? 0 : std::min(arma::uword(c), m_rows - 1);
+}
+
+void mp::Grid2D::searchCell(arma::uword cx, arma::uword cy,
+                            double x, double y,
+                            arma::uword k, arma::uword skip,
+                            std::vector<HeapItem> &heap) const
+{
+    arma::uword c = cy * m_cols + cx;
+    for (arma::uword l = m_cellStart[c]; l < m_cellStart[c + 1]; l++) {
+        const Point &p = m_points[l];
+        if (p.index == skip) {
+            continue;
+        }
+
+        // Squared distances until the very end
+        double d = (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y);
+        if (heap.size() < k) {
+            heap.push_back(HeapItem(d, p.index));
+            std::push_heap(heap.begin(), heap.end());
+        } else if (d < heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = HeapItem(d, p.index);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+}
+
+void mp::Grid2D::knn(double x, double y, arma::uword k, arma::uword *nn, double *dist,
+                     arma::uword skip) const
+{
+    if (k == 0 || m_points.empty()) {
+        return;
+    }
+
+    std::vector<HeapItem> heap;
+    heap.reserve(k);
+
+    // Visit rings of cells around the query's cell; points in ring r or
+    // beyond are at least r - 1 cells away, so the search stops once the k
+    // nearest found so far are all closer than that
+    long cx = long(cellX(x)), cy = long(cellY(y));
+    long maxRing = long(std::max(m_cols, m_rows));
+    for (long r = 0; r <= maxRing; r++) {
+        double bound = (r - 1) * m_cellSize;
+        if (r > 0 && heap.size() == k && heap.front().first <= bound * bound) {
+            break;
+        }
+
+        long x0 = std::max(cx - r, 0L), x1 = std::min(cx + r, long(m_cols) - 1);
+        long y0 = std::max(cy - r, 0L), y1 = std::min(cy + r, long(m_rows) - 1);
+        for (long j = y0; j <= y1; j++) {
+            bool edgeRow = (j == cy - r || j == cy + r);
+            for (long i = x0; i <= x1; i++) {
+                // Only the cells on the ring itself; inner ones were visited
+                if (!edgeRow && i != cx - r && i != cx + r) {
+                    continue;
+                }
+
+                searchCell(i, j, x, y, k, skip, heap);
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+    for (arma::uword i = 0; i < heap.size(); i++) {
+        dist[i] = sqrt(heap[i].first);
+        nn[i] = heap[i].second;
+    }
+}
+
+void mp::Grid2D::radius(double x, double y, double r, std::vector<arma::uword> &nn) const
+{
+    nn.clear();
+    if (m_points.empty()) {
+        return;
+    }
+
+    arma::uword x0 = cellX(x - r), x1 = cellX(x + r);
+    arma::uword y0 = cellY(y - r), y1 = cellY(y + r);
+    for (arma::uword j = y0; j <= y1; j++) {
+        for (arma::uword i = x0; i <= x1; i++) {
+            arma::uword c = j * m_cols + i;
+            for (arma::uword l = m_cellStart[c]; l < m_cellStart[c + 1]; l++) {
+                const Point &p = m_points[l];
+                if ((p.x - x) * (p.x - x) + (p.y - y) * (p.y - y) <= r * r) {
+                    nn.push_back(p.index);
+                }
+            }
+        }
+    }
+}
+
+void mp::Grid2D::knnGraph(arma::uword k, arma::umat &nn, arma::mat &dist) const
+{
+    k = std::min(k, size() > 0 ? size() - 1 : 0);
+    nn.set_size(k, size());
+    dist.set_size(k, size());
+
+    int n = uintToInt<arma::uword, int>(size());
+
+    // Points are visited in cell order, so consecutive queries touch the same
+    // cells
+    #pragma omp parallel for schedule(dynamic, 256) shared(k, nn, dist, n)
+    for (int l = 0; l < n; l++) {
+        const Point &p = m_points[l];
+        knn(p.x, p.y, k, nn.colptr(p.index), dist.colptr(p.index), p.index);
+    }
+}
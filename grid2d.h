@@ -0,0 +1,70 @@
+#ifndef GRID2D_H
+#define GRID2D_H
+
+#include <utility>
+#include <vector>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * A uniform grid over the points (rows) of a 2D map, answering k nearest
+ * neighbors and radius queries by only visiting cells around the query point.
+ * Cells hold a few points each on average, so building the grid is O(n) and
+ * queries on evenly spread maps are O(k).
+ */
+class Grid2D
+{
+public:
+    // Passed as skip when no point is to be skipped
+    static const arma::uword NONE = arma::uword(-1);
+
+    Grid2D();
+    Grid2D(const arma::mat &Y);
+
+    void build(const arma::mat &Y);
+
+    arma::uword size() const { return m_points.size(); }
+
+    // The k nearest points to (x, y), except skip, ordered by increasing
+    // distance; nn and dist must hold at least k elements
+    void knn(double x, double y, arma::uword k, arma::uword *nn, double *dist,
+             arma::uword skip = NONE) const;
+
+    // Points within distance r of (x, y), in no particular order
+    void radius(double x, double y, double r, std::vector<arma::uword> &nn) const;
+
+    // Column i of nn (and dist) holds the k nearest neighbors of point i other
+    // than itself, nearest first. Points are queried in parallel.
+    void knnGraph(arma::uword k, arma::umat &nn, arma::mat &dist) const;
+
+private:
+    struct Point {
+        double x, y;
+        arma::uword index;
+    };
+
+    typedef std::pair<double, arma::uword> HeapItem;
+
+    arma::uword cellX(double x) const;
+    arma::uword cellY(double y) const;
+
+    // Visits the points of cell (cx, cy), keeping the k nearest in heap
+    void searchCell(arma::uword cx, arma::uword cy,
+                    double x, double y,
+                    arma::uword k, arma::uword skip,
+                    std::vector<HeapItem> &heap) const;
+
+    double m_minX, m_minY, m_cellSize;
+    arma::uword m_cols, m_rows;
+
+    // Points sorted by cell; those of cell c are in
+    // [m_cellStart[c], m_cellStart[c + 1])
+    std::vector<Point> m_points;
+    std::vector<arma::uword> m_cellStart;
+};
+
+} // namespace mp
+
+#endif // GRID2D_H
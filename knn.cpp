@@ -1,5 +1,9 @@
 #include "mp.h"
 
+#include <algorithm>
+
+#include "utils.h"
+
 void mp::knn(const arma::mat &dmat, arma::uword i, arma::uword k, arma::uvec &nn, arma::vec &dist)
 {
     arma::uword n = dist.n_rows;
@@ -28,3 +32,51 @@ void mp::knn(const arma::mat &dmat, arma::uword i, arma::uword k, arma::uvec &nn
         dmax = dist[k - 1];
     }
 }
+
+void mp::nearestNeighbors(const arma::vec &dist, arma::uword i, arma::uword k, arma::uvec &nn)
+{
+    arma::uword n = dist.n_elem;
+    k = std::min(k, n > 0 ? n - 1 : 0);
+
+    // Every index except i; ties are broken by index so results never depend
+    // on the order elements are visited
+    arma::uvec candidates(n > 0 ? n - 1 : 0);
+    for (arma::uword j = 0, l = 0; j < n; j++) {
+        if (j != i) {
+            candidates[l++] = j;
+        }
+    }
+
+    auto closer = [&dist](arma::uword a, arma::uword b) {
+        return dist[a] < dist[b] || (dist[a] == dist[b] && a < b);
+    };
+
+    // Partial selection: O(n) to find the k nearest, then only those are sorted
+    if (k < candidates.n_elem) {
+        std::nth_element(candidates.begin(), candidates.begin() + k,
+                         candidates.end(), closer);
+    }
+    std::sort(candidates.begin(), candidates.begin() + k, closer);
+    nn = candidates.head(k);
+}
+
+void mp::knn(const mp::DistMatrix &D, arma::uword k, arma::umat &nn)
+{
+    k = std::min(k, D.size() > 0 ? D.size() - 1 : 0);
+    nn.set_size(k, D.size());
+
+    int n = uintToInt<arma::uword, int>(D.size());
+
+    #pragma omp parallel shared(D, k, nn, n)
+    {
+        arma::vec dist;
+        arma::uvec neighbors;
+
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            D.row(i, dist);
+            nearestNeighbors(dist, i, k, neighbors);
+            nn.col(i) = neighbors;
+        }
+    }
+}
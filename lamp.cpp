@@ -1,8 +1,13 @@
 #include "mp.h"
 
 #include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
 
+#include "lampengine.h"
 #include "utils.h"
+#include "vptree.h"
 
 static const double EPSILON = 1e-6;
 
@@ -13,7 +18,7 @@ arma::mat mp::lamp(const arma::mat &X, const arma::uvec &sampleIndices, const ar
     return projection;
 }
 
-void mp::lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y)
+static void lampGeneric(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y)
 {
     int n = uintToInt<arma::uword, int>(X.n_rows);
     const arma::mat &Xs = X.rows(sampleIndices);
@@ -57,8 +62,443 @@ void mp::lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::m
 
         Y.row(i) = (point - Xtil) * M + Ytil;
     }
+}
+
+/*
+ * Computes out = v C (C^T C)^{-1/2}, that is, v mapped by the orthogonal
+ * (polar) factor of the d x 2 matrix C = [c0 c1], which is the same as U V^T
+ * from the SVD of C. The square root of the 2x2 matrix S = C^T C has the
+ * closed form sqrt(S) = (S + sqrt(det S) I) / sqrt(tr S + 2 sqrt(det S)).
+ * Returns false (leaving out untouched) if C is close to rank-deficient.
+ */
+static bool orthogonalMap2D(const double *v,
+                            const double *c0,
+                            const double *c1,
+                            arma::uword d,
+                            arma::vec::fixed<2> &out)
+{
+    arma::mat::fixed<2, 2> S;
+    arma::vec::fixed<2> w;
+    S.zeros();
+    w.zeros();
+    for (arma::uword k = 0; k < d; k++) {
+        S(0, 0) += c0[k] * c0[k];
+        S(0, 1) += c0[k] * c1[k];
+        S(1, 1) += c1[k] * c1[k];
+        w[0] += v[k] * c0[k];
+        w[1] += v[k] * c1[k];
+    }
+    S(1, 0) = S(0, 1);
+
+    double trace = S(0, 0) + S(1, 1);
+    double det = S(0, 0) * S(1, 1) - S(0, 1) * S(1, 0);
+    if (!(det > EPSILON * trace * trace)) {
+        return false;
+    }
 
-    for (arma::uword i = 0; i < sampleSize; i++) {
+    // (S + delta I)^{-1} * sqrt(tr S + 2 delta) is the inverse of sqrt(S)
+    double delta = sqrt(det);
+    double t = sqrt(trace + 2 * delta);
+    double a = S(0, 0) + delta;
+    double b = S(0, 1);
+    double c = S(1, 1) + delta;
+    double f = t / (a*c - b*b);
+    out[0] = f * ( c * w[0] - b * w[1]);
+    out[1] = f * (-b * w[0] + a * w[1]);
+    return true;
+}
+
+// Same as orthogonalMap2D(), through an SVD; handles rank-deficient C
+static void orthogonalMapSVD(const double *v,
+                             const double *c0,
+                             const double *c1,
+                             arma::uword d,
+                             arma::vec::fixed<2> &out)
+{
+    arma::mat C(d, 2);
+    std::copy(c0, c0 + d, C.colptr(0));
+    std::copy(c1, c1 + d, C.colptr(1));
+
+    arma::mat U, V;
+    arma::vec s;
+    arma::svd_econ(U, s, V, C);
+    out = (arma::rowvec(v, d) * U * V.t()).t();
+}
+
+/*
+ * LAMP specialized for 2D maps: every buffer is allocated once per thread and
+ * the orthogonal mapping has a closed form, so that nothing is allocated per
+ * point (barring degenerate cases).
+ */
+static void lamp2D(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y)
+{
+    int n = uintToInt<arma::uword, int>(X.n_rows);
+    arma::uword d = X.n_cols;
+    arma::uword sampleSize = sampleIndices.n_elem;
+
+    // One sample per column, so each sample is contiguous in memory
+    const arma::mat &XsT = X.rows(sampleIndices).t();
+
+    #pragma omp parallel shared(X, XsT, Ys, Y, n, d, sampleSize)
+    {
+        arma::vec point(d), Xtil(d), alphas(sampleSize);
+        arma::mat C(d, 2);
+        arma::vec::fixed<2> Ytil, y;
+
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            for (arma::uword k = 0; k < d; k++) {
+                point[k] = X(i, k);
+            }
+
+            // calculate alphas, \tilde{X} and \tilde{Y}
+            double alphasSum = 0;
+            Xtil.zeros();
+            Ytil.zeros();
+            for (arma::uword j = 0; j < sampleSize; j++) {
+                const double *xj = XsT.colptr(j);
+                double dist = 0;
+                for (arma::uword k = 0; k < d; k++) {
+                    dist += (xj[k] - point[k]) * (xj[k] - point[k]);
+                }
+
+                double alpha = 1. / std::max(dist, EPSILON);
+                alphas[j] = alpha;
+                alphasSum += alpha;
+                for (arma::uword k = 0; k < d; k++) {
+                    Xtil[k] += alpha * xj[k];
+                }
+                Ytil[0] += alpha * Ys(j, 0);
+                Ytil[1] += alpha * Ys(j, 1);
+            }
+            Xtil /= alphasSum;
+            Ytil /= alphasSum;
+
+            // C = A^T B = \sum_j alpha_j (x_j - \tilde{x})^T (y_j - \tilde{y})
+            C.zeros();
+            double *c0 = C.colptr(0);
+            double *c1 = C.colptr(1);
+            for (arma::uword j = 0; j < sampleSize; j++) {
+                const double *xj = XsT.colptr(j);
+                double u0 = alphas[j] * (Ys(j, 0) - Ytil[0]);
+                double u1 = alphas[j] * (Ys(j, 1) - Ytil[1]);
+                for (arma::uword k = 0; k < d; k++) {
+                    double diff = xj[k] - Xtil[k];
+                    c0[k] += u0 * diff;
+                    c1[k] += u1 * diff;
+                }
+            }
+
+            point -= Xtil;
+            if (!orthogonalMap2D(point.memptr(), c0, c1, d, y)) {
+                orthogonalMapSVD(point.memptr(), c0, c1, d, y);
+            }
+
+            Y(i, 0) = y[0] + Ytil[0];
+            Y(i, 1) = y[1] + Ytil[1];
+        }
+    }
+}
+
+void mp::lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y)
+{
+    if (Ys.n_cols == 2) {
+        lamp2D(X, sampleIndices, Ys, Y);
+    } else {
+        lampGeneric(X, sampleIndices, Ys, Y);
+    }
+
+    for (arma::uword i = 0; i < sampleIndices.n_elem; i++) {
         Y.row(sampleIndices[i]) = Ys.row(i);
     }
 }
+
+void mp::lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y, arma::uword k)
+{
+    mp::LAMPEngine(X, sampleIndices, k).project(Ys, Y);
+}
+
+mp::LAMPEngine::LAMPEngine(const std::shared_ptr<const arma::mat> &X,
+                           const arma::uvec &sampleIndices,
+                           arma::uword k)
+    : m_handle(X)
+    , m_X(X.get())
+    , m_sampleIndices(sampleIndices)
+    , m_XsT(X->rows(sampleIndices).t())
+{
+    computeAlphas(k);
+}
+
+mp::LAMPEngine::LAMPEngine(const arma::mat &X,
+                           const arma::uvec &sampleIndices,
+                           arma::uword k)
+    : m_X(&X)
+    , m_sampleIndices(sampleIndices)
+    , m_XsT(X.rows(sampleIndices).t())
+{
+    computeAlphas(k);
+}
+
+void mp::LAMPEngine::computeAlphas(arma::uword k)
+{
+    const arma::mat &X = *m_X;
+    const arma::uvec &sampleIndices = m_sampleIndices;
+    int n = uintToInt<arma::uword, int>(X.n_rows);
+    arma::uword d = X.n_cols;
+    arma::uword sampleSize = sampleIndices.n_elem;
+
+    if (k == 0 || k >= sampleSize) {
+        m_alphas.set_size(X.n_rows, sampleSize);
+
+        #pragma omp parallel shared(X, n, d, sampleSize)
+        {
+            arma::vec point(d);
+
+            #pragma omp for
+            for (int i = 0; i < n; i++) {
+                for (arma::uword l = 0; l < d; l++) {
+                    point[l] = X(i, l);
+                }
+
+                for (arma::uword j = 0; j < sampleSize; j++) {
+                    const double *xj = m_XsT.colptr(j);
+                    double dist = 0;
+                    for (arma::uword l = 0; l < d; l++) {
+                        dist += (xj[l] - point[l]) * (xj[l] - point[l]);
+                    }
+                    m_alphas(i, j) = 1. / std::max(dist, EPSILON);
+                }
+            }
+        }
+
+        m_alphasSum = arma::sum(m_alphas, 1);
+    } else {
+        // Only the k nearest samples of each point are taken into account
+        mp::VPTree tree(X.rows(sampleIndices));
+        m_neighbors.set_size(k, X.n_rows);
+        m_alphas.set_size(k, X.n_rows);
+        m_alphasSum.set_size(X.n_rows);
+
+        #pragma omp parallel shared(X, tree, n, d, k)
+        {
+            arma::vec point(d), dist(k);
+
+            #pragma omp for
+            for (int i = 0; i < n; i++) {
+                for (arma::uword l = 0; l < d; l++) {
+                    point[l] = X(i, l);
+                }
+
+                arma::uword *neighbors = m_neighbors.colptr(i);
+                double *alphas = m_alphas.colptr(i);
+                tree.knn(point.memptr(), k, neighbors, dist.memptr());
+
+                double alphasSum = 0;
+                for (arma::uword j = 0; j < k; j++) {
+                    alphas[j] = 1. / std::max(dist[j] * dist[j], EPSILON);
+                    alphasSum += alphas[j];
+                }
+
+                m_alphasSum[i] = alphasSum;
+            }
+        }
+    }
+
+}
+
+arma::mat mp::LAMPEngine::project(const arma::mat &Ys) const
+{
+    arma::mat Y(m_X->n_rows, Ys.n_cols);
+    project(Ys, Y);
+    return Y;
+}
+
+void mp::LAMPEngine::project(const arma::mat &Ys, arma::mat &Y) const
+{
+    Y.set_size(m_X->n_rows, Ys.n_cols);
+    arma::uvec rows = arma::regspace<arma::uvec>(0, m_X->n_rows - 1);
+    if (m_neighbors.is_empty()) {
+        projectDense(rows, Ys, Y);
+    } else {
+        projectSparse(rows, Ys, Y);
+    }
+
+    for (arma::uword i = 0; i < m_sampleIndices.n_elem; i++) {
+        Y.row(m_sampleIndices[i]) = Ys.row(i);
+    }
+}
+
+void mp::LAMPEngine::project(const arma::mat &Ys, arma::mat &Y, const arma::uvec &rows) const
+{
+    if (m_neighbors.is_empty()) {
+        projectDense(rows, Ys, Y);
+    } else {
+        projectSparse(rows, Ys, Y);
+    }
+
+    for (arma::uword i = 0; i < m_sampleIndices.n_elem; i++) {
+        Y.row(m_sampleIndices[i]) = Ys.row(i);
+    }
+}
+
+arma::uvec mp::LAMPEngine::influencedBy(const arma::uvec &samples, double tol) const
+{
+    arma::uword n = m_X->n_rows;
+    arma::vec weights;
+    if (m_neighbors.is_empty()) {
+        weights = arma::sum(m_alphas.cols(samples), 1);
+    } else {
+        std::vector<bool> isSample(m_XsT.n_cols, false);
+        for (auto j: samples) {
+            isSample[j] = true;
+        }
+
+        weights.zeros(n);
+        for (arma::uword i = 0; i < n; i++) {
+            for (arma::uword j = 0; j < m_neighbors.n_rows; j++) {
+                if (isSample[m_neighbors(j, i)]) {
+                    weights[i] += m_alphas(j, i);
+                }
+            }
+        }
+    }
+
+    return arma::find(weights / m_alphasSum > tol);
+}
+
+void mp::LAMPEngine::projectDense(const arma::uvec &rows, const arma::mat &Ys, arma::mat &Y) const
+{
+    int m = uintToInt<arma::uword, int>(rows.n_elem);
+    arma::uword d = m_XsT.n_rows;
+    arma::uword dims = Ys.n_cols;
+    arma::uword numSamples = m_XsT.n_cols;
+    const arma::mat &X = *m_X;
+
+    #pragma omp parallel shared(X, rows, Ys, Y, m, d, dims, numSamples)
+    {
+        arma::vec point(d), Xtil(d);
+        arma::rowvec Ytil(dims);
+        arma::mat AtB(d, dims);
+        arma::vec::fixed<2> y;
+
+        #pragma omp for
+        for (int r = 0; r < m; r++) {
+            arma::uword i = rows[r];
+
+            // Since A^T B = \sum_j alpha_j (x_j - \tilde{x})^T (y_j - \tilde{y})
+            //             = \sum_j alpha_j x_j^T y_j - (\sum_j alpha_j) \tilde{x}^T \tilde{y},
+            // all sums are taken in a single pass over the samples, with
+            // Xtil holding (\sum_j alpha_j) \tilde{x} at first
+            Xtil.zeros();
+            Ytil.zeros();
+            AtB.zeros();
+            for (arma::uword j = 0; j < numSamples; j++) {
+                const double *xj = m_XsT.colptr(j);
+                double alpha = m_alphas(i, j);
+                for (arma::uword l = 0; l < d; l++) {
+                    Xtil[l] += alpha * xj[l];
+                }
+                for (arma::uword c = 0; c < dims; c++) {
+                    double u = alpha * Ys(j, c);
+                    double *col = AtB.colptr(c);
+                    Ytil[c] += u;
+                    for (arma::uword l = 0; l < d; l++) {
+                        col[l] += u * xj[l];
+                    }
+                }
+            }
+            Ytil /= m_alphasSum[i];
+            AtB -= Xtil * Ytil;
+            Xtil /= m_alphasSum[i];
+
+            for (arma::uword l = 0; l < d; l++) {
+                point[l] = X(i, l) - Xtil[l];
+            }
+
+            if (dims == 2) {
+                if (!orthogonalMap2D(point.memptr(), AtB.colptr(0), AtB.colptr(1), d, y)) {
+                    orthogonalMapSVD(point.memptr(), AtB.colptr(0), AtB.colptr(1), d, y);
+                }
+
+                Y(i, 0) = y[0] + Ytil[0];
+                Y(i, 1) = y[1] + Ytil[1];
+            } else {
+                arma::mat U, V;
+                arma::vec s;
+                arma::svd_econ(U, s, V, AtB);
+                Y.row(i) = point.t() * U * V.t() + Ytil;
+            }
+        }
+    }
+}
+
+void mp::LAMPEngine::projectSparse(const arma::uvec &rows, const arma::mat &Ys, arma::mat &Y) const
+{
+    int m = uintToInt<arma::uword, int>(rows.n_elem);
+    arma::uword d = m_XsT.n_rows;
+    arma::uword dims = Ys.n_cols;
+    arma::uword k = m_neighbors.n_rows;
+    const arma::mat &X = *m_X;
+
+    #pragma omp parallel shared(X, rows, Ys, Y, m, d, dims, k)
+    {
+        arma::vec point(d);
+        arma::rowvec Ytil(dims);
+        arma::mat AtB(d, dims);
+        arma::vec::fixed<2> y;
+
+        #pragma omp for
+        for (int r = 0; r < m; r++) {
+            arma::uword i = rows[r];
+            const arma::uword *neighbors = m_neighbors.colptr(i);
+            const double *alphas = m_alphas.colptr(i);
+
+            Ytil.zeros();
+            for (arma::uword j = 0; j < k; j++) {
+                for (arma::uword c = 0; c < dims; c++) {
+                    Ytil[c] += alphas[j] * Ys(neighbors[j], c);
+                }
+            }
+            Ytil /= m_alphasSum[i];
+
+            // As \sum_j alpha_j (y_j - \tilde{y}) = 0, we have that
+            // A^T B = \sum_j alpha_j x_j^T (y_j - \tilde{y})
+            AtB.zeros();
+            point.zeros();
+            for (arma::uword j = 0; j < k; j++) {
+                const double *xj = m_XsT.colptr(neighbors[j]);
+                for (arma::uword l = 0; l < d; l++) {
+                    point[l] += alphas[j] * xj[l];
+                }
+                for (arma::uword c = 0; c < dims; c++) {
+                    double u = alphas[j] * (Ys(neighbors[j], c) - Ytil[c]);
+                    double *col = AtB.colptr(c);
+                    for (arma::uword l = 0; l < d; l++) {
+                        col[l] += u * xj[l];
+                    }
+                }
+            }
+
+            // point - \tilde{x}
+            for (arma::uword l = 0; l < d; l++) {
+                point[l] = X(i, l) - point[l] / m_alphasSum[i];
+            }
+
+            if (dims == 2) {
+                const double *c0 = AtB.colptr(0);
+                const double *c1 = AtB.colptr(1);
+                if (!orthogonalMap2D(point.memptr(), c0, c1, d, y)) {
+                    orthogonalMapSVD(point.memptr(), c0, c1, d, y);
+                }
+
+                Y(i, 0) = y[0] + Ytil[0];
+                Y(i, 1) = y[1] + Ytil[1];
+            } else {
+                arma::mat U, V;
+                arma::vec s;
+                arma::svd_econ(U, s, V, AtB);
+                Y.row(i) = point.t() * U * V.t() + Ytil;
+            }
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef LAMPENGINE_H
+#define LAMPENGINE_H
+
+#include <memory>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * LAMP, split into the parts that depend only on X and the sample indices
+ * (the weights of each sample on every point), computed once on
+ * construction, and the parts that also depend on Ys, which are computed on
+ * every call to project(). The weighted X centroids are recomputed from the
+ * weights as needed, so nothing of the size of X is kept besides X itself.
+ * Given k > 0, each point only takes its k nearest samples into account
+ * (found through a VPTree), which brings the cost per point down from the
+ * number of samples to k.
+ */
+class LAMPEngine
+{
+public:
+    LAMPEngine(const std::shared_ptr<const arma::mat> &X,
+               const arma::uvec &sampleIndices,
+               arma::uword k = 0);
+
+    // X is not copied, so it must outlive the engine
+    LAMPEngine(const arma::mat &X,
+               const arma::uvec &sampleIndices,
+               arma::uword k = 0);
+
+    arma::mat project(const arma::mat &Ys) const;
+    void project(const arma::mat &Ys, arma::mat &Y) const;
+
+    // Only updates the given rows of Y (and the rows of samples)
+    void project(const arma::mat &Ys, arma::mat &Y, const arma::uvec &rows) const;
+
+    // Points on which the given samples have a total (normalized) weight
+    // larger than tol
+    arma::uvec influencedBy(const arma::uvec &samples, double tol) const;
+
+private:
+    void projectDense(const arma::uvec &rows, const arma::mat &Ys, arma::mat &Y) const;
+    void projectSparse(const arma::uvec &rows, const arma::mat &Ys, arma::mat &Y) const;
+    void computeAlphas(arma::uword k);
+
+    // Only set when X is shared, to keep it alive
+    std::shared_ptr<const arma::mat> m_handle;
+    const arma::mat *m_X;
+    arma::uvec m_sampleIndices;
+
+    // One sample per column
+    arma::mat m_XsT;
+
+    // Dense: alpha(i, j) is the (unnormalized) weight of sample j on point i.
+    // Sparse: alpha(j, i) is the weight of sample neighbors(j, i) on point i,
+    // so that the k neighbors of each point are contiguous.
+    arma::mat m_alphas;
+    arma::umat m_neighbors;
+    arma::vec m_alphasSum;
+};
+
+} // namespace mp
+
+#endif // LAMPENGINE_H
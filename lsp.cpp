@@ -0,0 +1,158 @@
+#include "mp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "lspengine.h"
+
+// CGLS stops once |A^T r| <= TOLERANCE * |A^T b| for every column
+static const double TOLERANCE = 1e-5;
+static const arma::uword MAX_ITERATIONS = 500;
+
+// Neighbors of each point when none is given
+static const arma::uword DEFAULT_NEIGHBORS = 15;
+
+arma::mat mp::lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::uword k)
+{
+    arma::mat Y(X.n_rows, Ys.n_cols);
+    mp::lsp(X, sampleIndices, Ys, Y, k);
+    return Y;
+}
+
+void mp::lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y, arma::uword k)
+{
+    LSPEngine engine(X, sampleIndices, k);
+    engine.project(Ys, Y);
+}
+
+mp::LSPEngine::LSPEngine(const arma::mat &X,
+                         const arma::uvec &sampleIndices,
+                         arma::uword k)
+    : m_sampleIndices(sampleIndices)
+    , m_tol(TOLERANCE)
+    , m_maxIter(MAX_ITERATIONS)
+    , m_iterations(0)
+{
+    if (k == 0) {
+        k = DEFAULT_NEIGHBORS;
+    }
+
+    // There may be fewer neighbors than asked for (none for a single point)
+    arma::umat nn;
+    arma::mat nnDist;
+    mp::knnGraph(X, k, nn, nnDist);
+    k = nn.n_rows;
+
+    // Row i: y_i - (1/k) sum_{j in N(i)} y_j = 0
+    // Row n + c: y_{s_c} = Ys_c
+    arma::uword n = X.n_rows;
+    arma::uword s = sampleIndices.n_elem;
+    arma::uword nnz = n * (k + 1) + s;
+    arma::umat locations(2, nnz);
+    arma::vec values(nnz);
+    arma::uword e = 0;
+    for (arma::uword i = 0; i < n; i++) {
+        locations(0, e) = i;
+        locations(1, e) = i;
+        values[e++] = 1;
+        for (arma::uword l = 0; l < k; l++) {
+            locations(0, e) = i;
+            locations(1, e) = nn(l, i);
+            values[e++] = -1. / k;
+        }
+    }
+    for (arma::uword c = 0; c < s; c++) {
+        locations(0, e) = n + c;
+        locations(1, e) = sampleIndices[c];
+        values[e++] = 1;
+    }
+
+    // Repeated samples would show up as repeated locations, which are summed
+    m_A = arma::sp_mat(true, locations, values, n + s, n);
+    m_At = m_A.t();
+
+    m_invDiag.zeros(n);
+    for (arma::sp_mat::const_iterator it = m_A.begin(); it != m_A.end(); ++it) {
+        m_invDiag[it.col()] += (*it) * (*it);
+    }
+    m_invDiag = 1 / m_invDiag;
+}
+
+arma::mat mp::LSPEngine::project(const arma::mat &Ys)
+{
+    arma::mat Y;
+    project(Ys, Y);
+    return Y;
+}
+
+bool mp::LSPEngine::project(const arma::mat &Ys,
+                            arma::mat &Y,
+                            const std::function<bool()> &cancelled)
+{
+    arma::uword n = m_A.n_cols;
+    arma::uword numCols = Ys.n_cols;
+    if (m_Y.n_rows != n || m_Y.n_cols != numCols) {
+        m_Y.zeros(n, numCols);
+    }
+    m_Y.rows(m_sampleIndices) = Ys;
+
+    arma::mat B(m_A.n_rows, numCols, arma::fill::zeros);
+    B.tail_rows(m_sampleIndices.n_elem) = Ys;
+    arma::rowvec target = m_tol * arma::sqrt(arma::sum(arma::square(m_At * B), 0));
+
+    // Preconditioned CGLS, each column of Y being an independent problem
+    arma::mat R = B - m_A * m_Y;
+    arma::mat S = m_At * R;
+    arma::mat Z = S;
+    Z.each_col() %= m_invDiag;
+    arma::mat P = Z;
+    arma::rowvec gamma = arma::sum(S % Z, 0);
+
+    // Columns are left alone (no more products with A) once they converge
+    std::vector<bool> converged(numCols, false);
+    for (m_iterations = 0; m_iterations < m_maxIter; m_iterations++) {
+        bool allConverged = true;
+        for (arma::uword j = 0; j < numCols; j++) {
+            converged[j] = converged[j] || arma::norm(S.col(j)) <= target[j];
+            allConverged = allConverged && converged[j];
+        }
+        if (allConverged) {
+            break;
+        }
+        if (cancelled && cancelled()) {
+            return false;
+        }
+
+        for (arma::uword j = 0; j < numCols; j++) {
+            if (converged[j]) {
+                continue;
+            }
+
+            arma::vec q = m_A * P.col(j);
+            double qq = arma::dot(q, q);
+            if (qq == 0) {
+                // P is zero, so this column cannot get any better
+                converged[j] = true;
+                continue;
+            }
+
+            double alpha = gamma[j] / qq;
+            m_Y.col(j) += alpha * P.col(j);
+            R.col(j) -= alpha * q;
+
+            S.col(j) = m_At * R.col(j);
+            arma::vec z = S.col(j) % m_invDiag;
+            double newGamma = arma::dot(S.col(j), z);
+            if (gamma[j] > 0) {
+                P.col(j) = z + (newGamma / gamma[j]) * P.col(j);
+            }
+            gamma[j] = newGamma;
+        }
+    }
+
+    // Samples are only softly constrained; show them where they were placed
+    Y = m_Y;
+    Y.rows(m_sampleIndices) = Ys;
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef LSPENGINE_H
+#define LSPENGINE_H
+
+#include <functional>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * Least Square Projection: every point should sit at the centroid of its k
+ * nearest neighbors (in X) and every sample at its position in Ys. The sparse
+ * (n + s) x n system with these rows is built once on construction (X itself
+ * is not kept) and solved in the least squares sense by conjugate gradients
+ * on the normal equations (CGLS), with a Jacobi preconditioner. Each call to
+ * project() starts from the previous solution, so small changes to Ys only
+ * take a few iterations to converge. A k of 0 means the default of 15.
+ */
+class LSPEngine
+{
+public:
+    LSPEngine(const arma::mat &X,
+              const arma::uvec &sampleIndices,
+              arma::uword k = 15);
+
+    void setTolerance(double tol) { m_tol = tol; }
+    void setMaxIterations(arma::uword maxIter) { m_maxIter = maxIter; }
+
+    arma::mat project(const arma::mat &Ys);
+
+    // Gives up (returning false) as soon as cancelled() returns true, which is
+    // checked on every iteration; the next call still starts from wherever
+    // the solver got to
+    bool project(const arma::mat &Ys,
+                 arma::mat &Y,
+                 const std::function<bool()> &cancelled = std::function<bool()>());
+
+    // Iterations taken by the last call to project()
+    arma::uword iterations() const { return m_iterations; }
+
+private:
+    arma::uvec m_sampleIndices;
+
+    // The system matrix and its transpose (kept, as sp_mat is column-major
+    // and both A p and A^T r are needed on every iteration)
+    arma::sp_mat m_A, m_At;
+
+    // Inverse of the diagonal of A^T A
+    arma::vec m_invDiag;
+
+    // Last solution, used as the starting point of the next solve
+    arma::mat m_Y;
+
+    double m_tol;
+    arma::uword m_maxIter, m_iterations;
+};
+
+} // namespace mp
+
+#endif // LSPENGINE_H
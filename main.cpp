@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <random>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <QApplication>
 #include <QtQml>
@@ -10,6 +14,7 @@
 #include <QSurfaceFormat>
 
 #include "main.h"
+#include "artifactcache.h"
 #include "mp.h"
 #include "continuouscolorscale.h"
 #include "scatterplot.h"
@@ -20,6 +25,7 @@
 #include "transitioncontrol.h"
 #include "projectionhistory.h"
 #include "manipulationhandler.h"
+#include "projectionworker.h"
 #include "mapscalehandler.h"
 #include "selectionhandler.h"
 #include "brushinghandler.h"
@@ -43,42 +49,52 @@ arma::uvec extractCPs(const arma::mat &X)
     return indices.subvec(0, numCPs-1);
 }
 
-arma::mat standardize(const arma::mat &X)
+// Bundles between the given fraction of RP/CP pairs with the largest
+// unreliability, among the pairs of the selected CPs
+static void showBundles(const Main *m, const arma::uvec &selectedCPs, double fraction)
 {
-    arma::mat stdX = X;
-    for (arma::uword j = 0; j < X.n_cols; j++) {
-        double sd = arma::stddev(stdX.col(j));
-        double mean = arma::mean(stdX.col(j));
-        stdX.col(j) = (stdX.col(j) - mean) / sd;
+    // (unreliability, (RP, CP))
+    typedef std::pair<double, std::pair<arma::uword, arma::uword>> Pair;
+
+    const arma::sp_mat &unreliability = m->projectionHistory->unreliability();
+    std::vector<Pair> pairs;
+    for (arma::uword cp : selectedCPs) {
+        for (auto it = unreliability.begin_col(cp); it != unreliability.end_col(cp); ++it) {
+            pairs.push_back(std::make_pair(*it, std::make_pair(it.row(), cp)));
+        }
     }
 
-    return stdX;
+    arma::uword numLargest = std::min(arma::uword(pairs.size() * fraction),
+                                      arma::uword(pairs.size()));
+    std::partial_sort(pairs.begin(), pairs.begin() + numLargest, pairs.end(),
+            [](const Pair &a, const Pair &b) { return a.first > b.first; });
+
+    const arma::uvec &cpIndices = m->projectionHistory->cpIndices();
+    const arma::uvec &rpIndices = m->projectionHistory->rpIndices();
+    arma::vec values(numLargest);
+    arma::uvec indices(2 * numLargest);
+    for (arma::uword l = 0; l < numLargest; l++) {
+        values[l] = pairs[l].first;
+        indices[2*l + 0] = cpIndices[pairs[l].second.second];
+        indices[2*l + 1] = rpIndices[pairs[l].second.first];
+    }
+    m->bundlePlot->setValues(values);
+    m->bundlePlot->setLines(indices, m->projectionHistory->Y());
 }
 
 void overviewBundles(const Main *m)
 {
-    const arma::mat &unreliability = m->projectionHistory->unreliability();
-    arma::uvec indicesLargest = arma::sort_index(unreliability, "descending");
-    arma::uword numLargest = m->projectionHistory->Y().n_rows * 0.1f;
-    indicesLargest = indicesLargest.subvec(0, numLargest-1);
-    m->bundlePlot->setValues(unreliability(indicesLargest));
-
     const arma::uvec &cpIndices = m->projectionHistory->cpIndices();
-    arma::uvec CPs = cpIndices(indicesLargest / unreliability.n_rows);
-
-    const arma::uvec &rpIndices = m->projectionHistory->rpIndices();
-    arma::uvec RPs = indicesLargest;
-    RPs.transform([&unreliability](arma::uword v) {
-        return v % unreliability.n_rows;
-    });
-    RPs = rpIndices(RPs);
-
-    arma::uvec indices(CPs.n_elem + RPs.n_elem);
-    for (arma::uword i = 0; i < CPs.n_elem; i++) {
-        indices[2*i + 0] = CPs(i);
-        indices[2*i + 1] = RPs(i);
+    const arma::sp_mat &unreliability = m->projectionHistory->unreliability();
+    if (cpIndices.is_empty()) {
+        return;
     }
-    m->bundlePlot->setLines(indices, m->projectionHistory->Y());
+
+    // As many bundles as 10% of the points
+    double fraction = unreliability.n_nonzero > 0
+        ? 0.1 * m->projectionHistory->Y().n_rows / unreliability.n_nonzero
+        : 0;
+    showBundles(m, arma::regspace<arma::uvec>(0, cpIndices.n_elem - 1), fraction);
 }
 
 int main(int argc, char **argv)
@@ -103,6 +119,14 @@ int main(int argc, char **argv)
         "Filename to store the control points' map. Omitting this option disables saving this map.",
         "filename");
     parser.addOption(cpFileOutputOption);
+    QCommandLineOption neighborsOption(QStringList() << "k" << "neighbors",
+        "Number of nearest control points influencing each point. Omitting this option (or 0) means all control points.",
+        "k", "0");
+    parser.addOption(neighborsOption);
+    QCommandLineOption cacheOption(QStringList() << "C" << "cache",
+        "Directory to cache startup computations in (standardized dataset, distances, initial CPs...). Omitting this option disables caching.",
+        "directory");
+    parser.addOption(cacheOption);
 
     parser.process(app);
     QStringList args = parser.positionalArguments();
@@ -110,14 +134,21 @@ int main(int argc, char **argv)
         parser.showHelp(1);
     }
 
+    ArtifactCache cache;
+    if (parser.isSet(cacheOption)
+        && !cache.open(parser.value(cacheOption), args[0].toStdString())) {
+        std::cerr << "Could not open cache, continuing without it.\n";
+    }
+
     // Load dataset
     Main *m = Main::instance();
-    if (!m->loadDataset(args[0].toStdString())) {
+    if (!m->loadDataset(args[0].toStdString(), &cache)) {
         std::cerr << "Could not load dataset.\n";
         return 1;
     }
 
-    const arma::mat &X = standardize(m->X());
+    std::shared_ptr<const arma::mat> data = m->X();
+    const arma::mat &X = *data;
 
     arma::arma_rng::set_seed(RNG_SEED);
     arma::uvec cpIndices;
@@ -134,8 +165,12 @@ int main(int argc, char **argv)
         cpIndices.load(indicesFilename.toStdString(), arma::raw_ascii);
         cpIndices -= 1;
     } else {
-        std::cerr << "No indices file, generating indices...\n";
-        cpIndices = extractCPs(X);
+        QString indicesName = QString("cpindices-seed%1").arg(RNG_SEED);
+        if (!cache.load(indicesName, cpIndices)) {
+            std::cerr << "No indices file, generating indices...\n";
+            cpIndices = extractCPs(X);
+            cache.save(indicesName, cpIndices);
+        }
     }
 
     // Load/generate CPs
@@ -148,12 +183,26 @@ int main(int argc, char **argv)
         m->setCPSavePath(cpFilename);
         Ys.load(cpFilename.toStdString(), arma::raw_ascii);
     } else {
-        std::cerr << "No CP file, generating initial projection...\n";
-        Ys.set_size(cpIndices.n_elem, 2);
-        Ys.randu();
-        mp::forceScheme(mp::dist(X.rows(cpIndices)), Ys);
+        // Named after the technique, so maps made differently are not reused
+        QString cpName = QString("cpmap-pfs-seed%1-%2")
+            .arg(RNG_SEED).arg(ArtifactCache::hashOf(cpIndices));
+        if (!cache.load(cpName, Ys)) {
+            std::cerr << "No CP file, generating initial projection...\n";
+            // With a cache, cpIndices may or may not have been generated (and
+            // consumed random numbers) by now; seeding again keeps the cached
+            // map the same either way. Without one, nothing changes.
+            if (cache.isOpen()) {
+                arma::arma_rng::set_seed(RNG_SEED);
+            }
+            Ys.set_size(cpIndices.n_elem, 2);
+            Ys.randu();
+            mp::parallelForceScheme(mp::dist(X.rows(cpIndices)), Ys, 20, 1e-3, 8, RNG_SEED);
+            cache.save(cpName, Ys);
+        }
     }
 
+    arma::uword numNeighbors = parser.value(neighborsOption).toULongLong();
+
     if (cpIndices.n_elem != Ys.n_rows) {
         std::cerr << "The number of CP indices and the CP map do not match." << std::endl;
         return 1;
@@ -204,8 +253,8 @@ int main(int argc, char **argv)
     TransitionControl *plotTC = engine.rootObjects()[0]->findChild<TransitionControl *>("plotTC");
 
     // Shared object which stores modifications to projections
-    ProjectionHistory history(X, cpIndices);
-    m->projectionHistory = &history;
+    ProjectionHistory history(data, cpIndices, numNeighbors, &cache);
+    m->setProjectionHistory(&history);
 
     // Keep track of the current cp (in order to save them later, if requested)
     QObject::connect(m->cpPlot, &Scatterplot::xyChanged,
@@ -228,14 +277,19 @@ int main(int argc, char **argv)
             &mapScaleHandler, &MapScaleHandler::scaleToMap);
 
     // Update projection as the cp are modified (either directly in the
-    // manipulationHandler object or interactively in cpPlot
-    ManipulationHandler manipulationHandler(X, cpIndices);
+    // manipulationHandler object or interactively in cpPlot, in which case
+    // the projection is computed in a separate thread)
+    ManipulationHandler manipulationHandler(data, cpIndices, numNeighbors);
+    ProjectionWorker projectionWorker(&manipulationHandler, m->projectionHistory);
+    m->projectionWorker = &projectionWorker;
     QObject::connect(m->cpPlot, &Scatterplot::xyInteractivelyChanged,
-            &manipulationHandler, &ManipulationHandler::setCP);
+            &projectionWorker, &ProjectionWorker::setCP);
 
     // Update history whenever a new projection is computed...
     QObject::connect(&manipulationHandler, &ManipulationHandler::mapChanged,
             m->projectionHistory, &ProjectionHistory::addMap);
+    QObject::connect(&projectionWorker, &ProjectionWorker::mapChanged,
+            m->projectionHistory, &ProjectionHistory::addMeasuredMap);
 
     // ... and update visual components whenever the history changes
     QObject::connect(m->projectionHistory, &ProjectionHistory::currentMapChanged,
@@ -275,29 +329,8 @@ int main(int argc, char **argv)
                 std::copy(selectedCPIndices.begin(), selectedCPIndices.end(),
                         selectedCPs.begin());
 
-                // Only the 10% largest values, filtered by the selected RPs
-                const arma::mat &unreliability = m->projectionHistory->unreliability();
-                arma::uvec indicesLargest = arma::sort_index(unreliability.cols(selectedCPs), "descending");
-                arma::uword numLargest = indicesLargest.n_elem * 0.01f;
-                indicesLargest = indicesLargest.subvec(0, numLargest-1);
-                m->bundlePlot->setValues(unreliability(indicesLargest));
-
-                const arma::uvec &cpIndices = m->projectionHistory->cpIndices();
-                arma::uvec CPs = cpIndices(selectedCPs(indicesLargest / unreliability.n_rows));
-
-                const arma::uvec &rpIndices = m->projectionHistory->rpIndices();
-                arma::uvec RPs = indicesLargest;
-                RPs.transform([&unreliability](arma::uword v) {
-                    return v % unreliability.n_rows;
-                });
-                RPs = rpIndices(RPs);
-
-                arma::uvec indices(CPs.n_elem + RPs.n_elem);
-                for (arma::uword i = 0; i < CPs.n_elem; i++) {
-                    indices[2*i + 0] = CPs(i);
-                    indices[2*i + 1] = RPs(i);
-                }
-                m->bundlePlot->setLines(indices, m->projectionHistory->Y());
+                // Only the 1% largest values, filtered by the selected CPs
+                showBundles(m, selectedCPs, 0.01);
             });
 
     SelectionHandler rpSelectionHandler(X.n_rows - cpIndices.n_elem);
@@ -449,6 +482,7 @@ int main(int argc, char **argv)
     // This sets the initial CP configuration, triggering all the necessary
     // signals to set up the helper objects and visual components
     manipulationHandler.setCP(Ys);
+    projectionWorker.start();
 
     return app.exec();
 }
@@ -2,17 +2,22 @@
 #define MAIN_H
 
 #include <QObject>
+#include <QStringList>
 #include <armadillo>
 #include <memory>
 
+#include "artifactcache.h"
 #include "colorscale.h"
 #include "continuouscolorscale.h"
+#include "datasetio.h"
 #include "divergentcolorscale.h"
 #include "projectionhistory.h"
 #include "numericrange.h"
 #include "barchart.h"
 #include "colormap.h"
 #include "lineplot.h"
+#include "mp.h"
+#include "projectionworker.h"
 #include "scatterplot.h"
 #include "voronoisplat.h"
 
@@ -21,6 +26,8 @@ class Main : public QObject
     Q_OBJECT
     Q_ENUMS(ObserverType)
     Q_ENUMS(ColorScaleType)
+    Q_ENUMS(Technique)
+    Q_PROPERTY(QStringList measureNames READ measureNames NOTIFY measureNamesChanged)
 public:
     static Main *instance() {
         // FIXME: Possibly dangerous
@@ -44,8 +51,40 @@ public:
         return ret;
     }
 
-    Q_INVOKABLE bool loadDataset(const std::string &dataPath) {
-        return m_X.load(dataPath, arma::raw_ascii);
+    // The dataset is standardized as it is loaded, and from then on shared
+    // (read-only) by every component that needs it. Binary datasets are
+    // mapped in place instead of parsed (see pmconvert), and so are text
+    // datasets found in the cache.
+    Q_INVOKABLE bool loadDataset(const std::string &dataPath,
+                                 const ArtifactCache *cache = nullptr) {
+        std::shared_ptr<arma::mat> X;
+        DatasetInfo info;
+        bool binary = isBinaryDataset(dataPath);
+        if (!binary && cache && (X = cache->loadDataset("x-standardized"))) {
+            m_X = X;
+            return true;
+        }
+
+        if (binary) {
+            X = loadBinaryDataset(dataPath, &info);
+            if (!X) {
+                return false;
+            }
+        } else {
+            X = std::make_shared<arma::mat>();
+            if (!loadTable(dataPath, *X)) {
+                return false;
+            }
+        }
+
+        if (!info.standardized) {
+            mp::standardize(*X);
+        }
+        if (!binary && cache) {
+            cache->saveDataset("x-standardized", *X);
+        }
+        m_X = X;
+        return true;
     }
 
     Q_INVOKABLE void setIndicesSavePath(const std::string &path) {
@@ -61,7 +100,7 @@ public:
         setCPSavePath(path.toStdString());
     }
 
-    arma::mat X() const { return m_X; }
+    std::shared_ptr<const arma::mat> X() const { return m_X; }
 
     Q_INVOKABLE void setSelectRPs() {
         cpPlot->setAcceptedMouseButtons(Qt::NoButton);
@@ -133,6 +172,11 @@ public:
     // Object that controls manipulation history
     ProjectionHistory *projectionHistory;
 
+    void setProjectionHistory(ProjectionHistory *history) {
+        projectionHistory = history;
+        emit measureNamesChanged();
+    }
+
     Q_INVOKABLE void undoManipulation()  { projectionHistory->undo(); }
     Q_INVOKABLE void resetManipulation() { projectionHistory->reset(); }
 
@@ -155,12 +199,46 @@ public:
         return false;
     }
 
+    // Names of the measures, in the order setMeasure() takes them
+    QStringList measureNames() const {
+        QStringList names;
+        if (projectionHistory) {
+            for (arma::uword m = 0; m < projectionHistory->numMeasures(); m++) {
+                names << QString::fromStdString(projectionHistory->measureName(m));
+            }
+        }
+        return names;
+    }
+
+    Q_INVOKABLE bool setMeasure(int measure) {
+        return measure >= 0 && projectionHistory->setMeasure(measure);
+    }
+
+    // Object that computes maps from the CP map, in its own thread
+    ProjectionWorker *projectionWorker;
+
+    enum Technique {
+        TechniquePLMP     = ManipulationHandler::TECHNIQUE_PLMP,
+        TechniqueLAMP     = ManipulationHandler::TECHNIQUE_LAMP,
+        TechniqueLSP      = ManipulationHandler::TECHNIQUE_LSP,
+        TechniquePekalska = ManipulationHandler::TECHNIQUE_PEKALSKA
+    };
+
+    // Switches techniques and projects the current CP map again
+    Q_INVOKABLE void setTechnique(Technique technique) {
+        projectionWorker->setTechnique(
+                static_cast<ManipulationHandler::Technique>(technique), m_cp);
+    }
+
+signals:
+    void measureNamesChanged();
+
 public slots:
     void setCPIndices(const arma::uvec &indices) {
         m_cpIndices = indices;
 
-        m_rpIndices.set_size(m_X.n_rows - m_cpIndices.n_elem);
-        NumericRange<arma::uword> allIndices(0, m_X.n_rows);
+        m_rpIndices.set_size(m_X->n_rows - m_cpIndices.n_elem);
+        NumericRange<arma::uword> allIndices(0, m_X->n_rows);
         std::set_symmetric_difference(allIndices.cbegin(), allIndices.cend(),
                 m_cpIndices.cbegin(), m_cpIndices.cend(), m_rpIndices.begin());
     }
@@ -194,6 +272,7 @@ private:
         , splat(0)
         , bundlePlot(0)
         , projectionHistory(0)
+        , projectionWorker(0)
     {
     }
 
@@ -221,7 +300,8 @@ private:
         }
     }
 
-    arma::mat m_X, m_cp;
+    std::shared_ptr<const arma::mat> m_X;
+    arma::mat m_cp;
     arma::uvec m_cpIndices, m_rpIndices;
     std::string m_indicesSavePath, m_cpSavePath;
 };
@@ -427,6 +427,17 @@ ApplicationWindow {
                     }
                 }
 
+                GroupBox {
+                    Layout.fillWidth: true
+                    title: "Projection technique"
+
+                    ComboBox {
+                        id: techniqueComboBox
+                        model: [ "LAMP", "PLMP", "LSP", "Pekalska" ]
+                        onActivated: Main.setTechnique([ Main.TechniqueLAMP, Main.TechniquePLMP, Main.TechniqueLSP, Main.TechniquePekalska ][index])
+                    }
+                }
+
                 GroupBox {
                     Layout.fillWidth: true
                     id: metricsGroupBox
@@ -434,6 +445,12 @@ ApplicationWindow {
                     property RadioButton current: currentMetricRadioButton
 
                     Column {
+                        ComboBox {
+                            id: measureComboBox
+                            model: Main.measureNames
+                            onActivated: Main.setMeasure(index)
+                        }
+
                         ExclusiveGroup { id: wrtMetricsGroup }
 
                         RadioButton {
@@ -1,34 +1,114 @@
 #include "manipulationhandler.h"
 
 #include <algorithm>
+#include <vector>
 
 #include "mp.h"
 
-ManipulationHandler::ManipulationHandler(const arma::mat &X,
-                                         const arma::uvec &cpIndices)
+// Default tolerance for incremental updates (see setIncrementalTolerance())
+static const double INCREMENTAL_TOLERANCE = 1e-3;
+
+ManipulationHandler::ManipulationHandler(const std::shared_ptr<const arma::mat> &X,
+                                         const arma::uvec &cpIndices,
+                                         arma::uword k)
     : m_X(X)
     , m_cpIndices(cpIndices)
+    , m_k(k)
     , m_technique(TECHNIQUE_LAMP)
+    , m_lamp(X, cpIndices, k)
+    , m_tol(INCREMENTAL_TOLERANCE)
+{
+}
+
+void ManipulationHandler::setTechnique(Technique technique)
 {
+    QMutexLocker locker(&m_mutex);
+    if (m_technique != technique) {
+        m_technique = technique;
+
+        // The next map is computed from scratch
+        m_Ys.reset();
+    }
 }
 
 void ManipulationHandler::setCP(const arma::mat &Ys)
 {
-    arma::mat Y(m_X.n_rows, 2);
-    switch (m_technique) {
-    case TECHNIQUE_PLMP:
-        // TODO?
-        break;
-    case TECHNIQUE_LSP:
-        // TODO?
-        break;
-    case TECHNIQUE_LAMP:
-        mp::lamp(m_X, m_cpIndices, Ys, Y);
-        break;
-    case TECHNIQUE_PEKALSKA:
-        // TODO?
-        break;
+    arma::mat Y;
+    arma::uvec changedRows;
+    if (project(Ys, Y, changedRows)) {
+        emit mapChanged(Y, changedRows);
+    }
+}
+
+bool ManipulationHandler::project(const arma::mat &Ys,
+                                  arma::mat &Y,
+                                  arma::uvec &changedRows,
+                                  const std::function<bool()> &cancelled)
+{
+    QMutexLocker locker(&m_mutex);
+    bool incremental = m_technique == TECHNIQUE_LAMP
+        && m_tol >= 0
+        && arma::size(m_Ys) == arma::size(Ys);
+
+    if (incremental) {
+        arma::uvec moved = arma::find(arma::any(m_Ys != Ys, 1));
+        if (moved.is_empty()) {
+            return false;
+        }
+
+        std::vector<bool> changed(m_X->n_rows, false);
+        arma::uvec influenced = m_lamp.influencedBy(moved, m_tol);
+        for (auto i: influenced) {
+            changed[i] = true;
+        }
+        for (auto cp: moved) {
+            changed[m_cpIndices[cp]] = true;
+        }
+
+        changedRows.set_size(std::count(changed.begin(), changed.end(), true));
+        for (arma::uword i = 0, j = 0; i < changed.size(); i++) {
+            if (changed[i]) {
+                changedRows[j++] = i;
+            }
+        }
+
+        m_lamp.project(Ys, m_Y, changedRows);
+    } else {
+        // Cancelled solves must leave the last map untouched
+        arma::mat newY(m_X->n_rows, 2);
+        bool done = true;
+        switch (m_technique) {
+        case TECHNIQUE_PLMP:
+            if (!m_plmp) {
+                m_plmp.reset(new mp::PLMPEngine(m_X, m_cpIndices));
+            }
+            m_plmp->project(Ys, newY);
+            break;
+        case TECHNIQUE_LSP:
+            if (!m_lsp) {
+                m_lsp.reset(new mp::LSPEngine(*m_X, m_cpIndices, m_k));
+            }
+            done = m_lsp->project(Ys, newY, cancelled);
+            break;
+        case TECHNIQUE_LAMP:
+            m_lamp.project(Ys, newY);
+            break;
+        case TECHNIQUE_PEKALSKA:
+            if (!m_pekalska) {
+                m_pekalska.reset(new mp::PekalskaEngine(m_X, m_cpIndices));
+            }
+            done = m_pekalska->project(Ys, newY, cancelled);
+            break;
+        }
+
+        if (!done) {
+            return false;
+        }
+        m_Y.swap(newY);
+        changedRows = arma::regspace<arma::uvec>(0, m_Y.n_rows - 1);
     }
 
-    emit mapChanged(Y);
+    m_Ys = Ys;
+    Y = m_Y;
+    return true;
 }
@@ -1,9 +1,18 @@
 #ifndef MANIPULATIONHANDLER_H
 #define MANIPULATIONHANDLER_H
 
+#include <functional>
+#include <memory>
+
+#include <QMutex>
 #include <QObject>
 #include <armadillo>
 
+#include "lampengine.h"
+#include "lspengine.h"
+#include "pekalskaengine.h"
+#include "plmpengine.h"
+
 class ManipulationHandler
     : public QObject
 {
@@ -17,21 +26,55 @@ public:
         TECHNIQUE_PEKALSKA
     };
 
-    ManipulationHandler(const arma::mat &X,
-                        const arma::uvec &cpIndices);
+    // k is the neighborhood size of LAMP (nearest CPs, all if 0) and LSP
+    // (nearest points, its default if 0)
+    ManipulationHandler(const std::shared_ptr<const arma::mat> &X,
+                        const arma::uvec &cpIndices,
+                        arma::uword k = 0);
+
+    void setTechnique(Technique technique);
+
+    // When only some CPs move, only points on which the moved CPs have a total
+    // weight larger than tol are projected again; the remaining ones keep
+    // their previous positions. A negative tol always reprojects every point.
+    void setIncrementalTolerance(double tol) { m_tol = tol; }
 
-    void setTechnique(Technique technique) { m_technique = technique; }
+    // Computes the map for the given CP map without emitting anything. Returns
+    // false if nothing changed since the last map, or if cancelled() returned
+    // true before the map was done (long solves check it as they go), in
+    // which case the last map is kept as the base of the next one. Safe to
+    // call from a worker thread.
+    bool project(const arma::mat &Ys,
+                 arma::mat &Y,
+                 arma::uvec &changedRows,
+                 const std::function<bool()> &cancelled = std::function<bool()>());
 
 signals:
-    void mapChanged(const arma::mat &Y) const;
+    // changedRows holds the indices of the rows of Y that may have changed
+    void mapChanged(const arma::mat &Y, const arma::uvec &changedRows) const;
 
 public slots:
     void setCP(const arma::mat &Ys);
 
 private:
-    arma::mat m_X;
+    std::shared_ptr<const arma::mat> m_X;
     arma::uvec m_cpIndices;
+    arma::uword m_k;
     Technique m_technique;
+
+    // Keep the Ys-invariant parts of each technique across calls to setCP();
+    // all but LAMP are only set up when first used
+    mp::LAMPEngine m_lamp;
+    std::unique_ptr<mp::PLMPEngine> m_plmp;
+    std::unique_ptr<mp::LSPEngine> m_lsp;
+    std::unique_ptr<mp::PekalskaEngine> m_pekalska;
+
+    // The last CP map and full map, for incremental updates
+    arma::mat m_Ys, m_Y;
+    double m_tol;
+
+    // Guards the state above when projecting from another thread
+    QMutex m_mutex;
 };
 
 #endif // MANIPULATIONHANDLER_H
@@ -3,38 +3,218 @@
 #include <cassert>
 #include <cmath>
 #include <algorithm>
+#include <vector>
 
 #include "utils.h"
 
 static const float EPSILON = 1e-6f;
 
+static void distRow(const arma::mat &D, arma::uword i, arma::vec &r)
+{
+    r = D.col(i);
+}
+
+static void distRow(const mp::DistMatrix &D, arma::uword i, arma::vec &r)
+{
+    D.row(i, r);
+}
+
+// Number of elements in common between two sets of k indices; both are
+// sorted in the process
+static arma::uword sharedCount(arma::uvec &a, arma::uvec &b)
+{
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+
+    arma::uword count = 0;
+    for (arma::uword i = 0, j = 0; i < a.n_elem && j < b.n_elem; ) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (b[j] < a[i]) {
+            j++;
+        } else {
+            count++;
+            i++;
+            j++;
+        }
+    }
+
+    return count;
+}
+
+template<typename DistA, typename DistB>
+static void neighborhoodPreservationKernel(const DistA &distA,
+                                           const DistB &distB,
+                                           arma::uword k,
+                                           arma::vec &v)
+{
+    int n = uintToInt<arma::uword, int>(v.n_elem);
+
+    #pragma omp parallel shared(distA, distB, k, v, n)
+    {
+        arma::vec dist;
+        arma::uvec nnA, nnB;
+
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            distRow(distA, i, dist);
+            mp::nearestNeighbors(dist, i, k, nnA);
+            distRow(distB, i, dist);
+            mp::nearestNeighbors(dist, i, k, nnB);
+
+            v[i] = nnA.n_elem > 0 ? double(sharedCount(nnA, nnB)) / nnA.n_elem : 1.0;
+        }
+    }
+}
+
 void mp::neighborhoodPreservation(const arma::mat &distA,
                                   const arma::mat &distB,
                                   arma::uword k,
                                   arma::vec &v)
 {
-    int n = uintToInt<arma::uword, int>(v.n_elem);
+    neighborhoodPreservationKernel(distA, distB, k, v);
+}
 
-    #pragma omp parallel for shared(v, n)
-    for (int i = 0; i < n; i++) {
-        //arma::uvec nnA(k);
-        //arma::uvec nnB(k);
-        //arma::vec dist(k);
+void mp::neighborhoodPreservation(const mp::DistMatrix &distA,
+                                  const mp::DistMatrix &distB,
+                                  arma::uword k,
+                                  arma::vec &v)
+{
+    neighborhoodPreservationKernel(distA, distB, k, v);
+}
 
-        //mp::knn(distA, i, k, nnA, dist);
-        //mp::knn(distB, i, k, nnB, dist);
+void mp::neighborhoodPreservation(const arma::umat &nnX,
+                                  const arma::mat &Y,
+                                  arma::vec &v)
+{
+    int n = uintToInt<arma::uword, int>(Y.n_rows);
+    arma::uword k = nnX.n_rows;
+    v.set_size(Y.n_rows);
 
-        arma::uvec nnA = arma::sort_index(distA.col(i));
-        nnA = nnA.subvec(2, k + 1);
-        arma::uvec nnB = arma::sort_index(distB.col(i));
-        nnB = nnB.subvec(2, k + 1);
+    // Neighbors in the map are found with a grid: O(n k) instead of O(n^2)
+    mp::Grid2D grid(Y);
 
-        std::sort(nnA.begin(), nnA.end());
-        std::sort(nnB.begin(), nnB.end());
+    #pragma omp parallel shared(nnX, Y, grid, k, v, n)
+    {
+        arma::uvec nnA, nnY(k);
+        arma::vec dist(k);
 
-        arma::uword l;
-        for (l = 0; nnA[l] == nnB[l] && l < k; l++);
-        v[i] = ((double) l) / k;
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            nnA = nnX.col(i);
+            grid.knn(Y(i, 0), Y(i, 1), k, nnY.memptr(), dist.memptr(), i);
+            v[i] = k > 0 ? double(sharedCount(nnA, nnY)) / k : 1.0;
+        }
+    }
+}
+
+namespace {
+
+// Calls f(j, d(i, j)) for every j != i, for each kind of input silhouette()
+// accepts
+struct DenseRows {
+    const arma::mat &D;
+
+    template<typename Func>
+    void operator()(arma::uword i, Func f) const {
+        const double *d = D.colptr(i);
+        for (arma::uword j = 0; j < D.n_rows; j++) {
+            if (j != i) {
+                f(j, d[j]);
+            }
+        }
+    }
+};
+
+struct PackedRows {
+    const mp::DistMatrix &D;
+
+    template<typename Func>
+    void operator()(arma::uword i, Func f) const {
+        D.forEachInRow(i, f);
+    }
+};
+
+// Points are stored one per column, so each distance reads contiguous memory
+struct PointRows {
+    const arma::mat &Xt;
+
+    template<typename Func>
+    void operator()(arma::uword i, Func f) const {
+        const double *xi = Xt.colptr(i);
+        for (arma::uword j = 0; j < Xt.n_cols; j++) {
+            if (j == i) {
+                continue;
+            }
+
+            const double *xj = Xt.colptr(j);
+            double sum = 0;
+            for (arma::uword l = 0; l < Xt.n_rows; l++) {
+                sum += (xi[l] - xj[l]) * (xi[l] - xj[l]);
+            }
+            f(j, sqrt(sum));
+        }
+    }
+};
+
+} // namespace
+
+/*
+ * Silhouette of every point, visiting each row of distances once: distances
+ * are summed per label as they come, so only (number of labels) sums per
+ * thread are needed. Sums are accumulated as AccT, which may be float when
+ * distances are floats themselves.
+ */
+template<typename AccT, typename Rows>
+static void silhouetteKernel(const Rows &rows,
+                             const arma::vec &labels,
+                             arma::vec &s)
+{
+    arma::vec uniqueLabels = arma::unique(labels);
+    arma::uword numLabels = uniqueLabels.n_elem;
+    arma::uword n = labels.n_elem;
+
+    // Labels as indices into per-label arrays
+    arma::uvec label(n);
+    arma::uvec count(numLabels, arma::fill::zeros);
+    for (arma::uword i = 0; i < n; i++) {
+        label[i] = std::lower_bound(uniqueLabels.begin(), uniqueLabels.end(), labels[i])
+                 - uniqueLabels.begin();
+        count[label[i]]++;
+    }
+
+    s.set_size(n);
+    int numPoints = uintToInt<arma::uword, int>(n);
+
+    #pragma omp parallel shared(rows, label, count, s, numLabels, numPoints)
+    {
+        std::vector<AccT> sums(numLabels);
+
+        #pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < numPoints; i++) {
+            std::fill(sums.begin(), sums.end(), AccT(0));
+            rows(i, [&](arma::uword j, double d) {
+                sums[label[j]] += AccT(d);
+            });
+
+            // Points alone in their cluster have silhouette 0 by definition
+            arma::uword own = label[i];
+            if (count[own] < 2) {
+                s[i] = 0;
+                continue;
+            }
+
+            double a = double(sums[own]) / (count[own] - 1);
+            double b = arma::datum::inf;
+            for (arma::uword l = 0; l < numLabels; l++) {
+                if (l != own) {
+                    b = std::min(b, double(sums[l]) / count[l]);
+                }
+            }
+
+            double m = std::max(a, b);
+            s[i] = (numLabels < 2 || m == 0) ? 0 : (b - a) / m;
+        }
     }
 }
 
@@ -42,13 +222,31 @@ arma::vec mp::silhouette(const arma::mat &distA,
                          const arma::mat &distB,
                          const arma::vec &labels)
 {
-    // TODO
-    return arma::vec(distA.n_rows, arma::fill::zeros);
+    arma::vec sA, sB;
+    silhouetteKernel<double>(DenseRows{distA}, labels, sA);
+    silhouetteKernel<double>(DenseRows{distB}, labels, sB);
+    return sB - sA;
 }
 
-void mp::aggregatedError(const arma::mat &distX,
-                         const arma::mat &distY,
-                         arma::vec &v)
+void mp::silhouette(const mp::DistMatrix &D,
+                    const arma::vec &labels,
+                    arma::vec &s)
+{
+    silhouetteKernel<mp::DistMatrix::elem_type>(PackedRows{D}, labels, s);
+}
+
+void mp::silhouetteFromPoints(const arma::mat &X,
+                              const arma::vec &labels,
+                              arma::vec &s)
+{
+    arma::mat Xt = X.t();
+    silhouetteKernel<double>(PointRows{Xt}, labels, s);
+}
+
+template<typename DistX, typename DistY>
+static void aggregatedErrorKernel(const DistX &distX,
+                                  const DistY &distY,
+                                  arma::vec &v)
 {
     int n = uintToInt<arma::uword, int>(v.n_elem);
     double maxX = distX.max();
@@ -72,6 +270,66 @@ void mp::aggregatedError(const arma::mat &distX,
     }
 }
 
+void mp::aggregatedError(const arma::mat &distX,
+                         const arma::mat &distY,
+                         arma::vec &v)
+{
+    aggregatedErrorKernel(distX, distY, v);
+}
+
+void mp::aggregatedError(const mp::DistMatrix &distX,
+                         const mp::DistMatrix &distY,
+                         arma::vec &v)
+{
+    aggregatedErrorKernel(distX, distY, v);
+}
+
+void mp::aggregatedError(const mp::DistMatrix &distX,
+                         const arma::mat &Y,
+                         arma::vec &v)
+{
+    int n = uintToInt<arma::uword, int>(v.n_elem);
+    double maxX = distX.max();
+    const double *y0 = Y.colptr(0);
+    const double *y1 = Y.colptr(1);
+
+    // First pass: largest (squared) distance in Y
+    double maxY = 0;
+    #pragma omp parallel shared(y0, y1, n, maxY)
+    {
+        double localMax = 0;
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                double dx = y0[i] - y0[j];
+                double dy = y1[i] - y1[j];
+                localMax = std::max(localMax, dx*dx + dy*dy);
+            }
+        }
+
+        #pragma omp critical
+        maxY = std::max(maxY, localMax);
+    }
+    maxY = sqrt(maxY);
+
+    // Second pass: the errors themselves, computing distances in Y as needed
+    #pragma omp parallel for shared(maxX, maxY, distX, y0, y1, v, n)
+    for (int i = 0; i < n; i++) {
+        double sum = 0;
+        distX.forEachInRow(i, [&](arma::uword j, double dX) {
+            double dx = y0[i] - y0[j];
+            double dy = y1[i] - y1[j];
+            double diff = fabs(sqrt(dx*dx + dy*dy) / maxY - dX / maxX);
+            if (diff >= EPSILON) {
+                sum += diff;
+            }
+        });
+
+        v[i] = sum;
+    }
+}
+
 /*
 double mp::stress(const arma::mat &Dp, const arma::mat &Dq)
 {
@@ -3,23 +3,57 @@
 
 #include <armadillo>
 
+#include "distmatrix.h"
+#include "grid2d.h"
+#include "vptree.h"
+
 namespace mp {
 
+// Preprocessing
+// Columns are scaled to zero mean and unit standard deviation; means and sds
+// can later be used to apply the exact same transform to new points
+void standardize(arma::mat &X);
+void standardize(arma::mat &X, arma::rowvec &means, arma::rowvec &sds);
+arma::mat standardized(const arma::mat &X, arma::rowvec &means, arma::rowvec &sds);
+void applyStandardization(arma::mat &X, const arma::rowvec &means, const arma::rowvec &sds);
+
 // Distance-related
 typedef double (*DistFunc)(const arma::rowvec &, const arma::rowvec &);
 double euclidean(const arma::rowvec &x1, const arma::rowvec &x2);
-arma::mat dist(const arma::mat &X, DistFunc dfunc = euclidean);
+arma::mat dist(const arma::mat &X);
+void dist(const arma::mat &X, arma::mat &D);
+void dist(const arma::mat &X, DistMatrix &D);
+arma::mat dist(const arma::mat &X, DistFunc dfunc);
+void dist(const arma::mat &X, DistMatrix &D, DistFunc dfunc);
 
 void knn(const arma::mat &dmat, arma::uword i, arma::uword k, arma::uvec &nn, arma::vec &dist);
+// Indices of the k smallest elements of dist other than i, nearest first
+void nearestNeighbors(const arma::vec &dist, arma::uword i, arma::uword k, arma::uvec &nn);
+// Column i of nn holds the k nearest neighbors of point i, nearest first
+void knn(const DistMatrix &D, arma::uword k, arma::umat &nn);
+// Same as above (also with distances), straight from the points: no distance
+// matrix is needed. Build a VPTree instead to answer further queries.
+void knnGraph(const arma::mat &X, arma::uword k, arma::umat &nn, arma::mat &dist);
 
 // Evaluation measures
 void neighborhoodPreservation(const arma::mat &distA, const arma::mat &distB, arma::uword k, arma::vec &v);
+void neighborhoodPreservation(const DistMatrix &distA, const DistMatrix &distB, arma::uword k, arma::vec &v);
+// Same as above, with the k nearest neighbors in the original space computed
+// beforehand (see knnGraph()), so only neighbors in the 2D map Y are searched for
+void neighborhoodPreservation(const arma::umat &nnX, const arma::mat &Y, arma::vec &v);
+// Silhouette of each point in B minus that in A (distance matrices)
 arma::vec silhouette(const arma::mat &distA, const arma::mat &distB, const arma::vec &labels);
+void silhouette(const DistMatrix &D, const arma::vec &labels, arma::vec &s);
+// Same as above, from the points (rows of X) instead of their distances
+void silhouetteFromPoints(const arma::mat &X, const arma::vec &labels, arma::vec &s);
 void aggregatedError(const arma::mat &distX, const arma::mat &distY, arma::vec &v);
+void aggregatedError(const DistMatrix &distX, const DistMatrix &distY, arma::vec &v);
+void aggregatedError(const DistMatrix &distX, const arma::mat &Y, arma::vec &v);
 
 // Techniques
 arma::mat lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys);
 void lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y);
+void lamp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y, arma::uword k);
 
 arma::mat plmp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys);
 void plmp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y);
@@ -27,13 +61,21 @@ void plmp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &
 arma::mat pekalska(const arma::mat &D, const arma::uvec &sampleIndices, const arma::mat &Ys);
 void pekalska(const arma::mat &D, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y);
 
-//arma::mat lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, int k = 15);
-//void lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y, int k = 15);
+arma::mat lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::uword k = 15);
+void lsp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y, arma::uword k = 15);
 
 arma::mat forceScheme(const arma::mat &D, arma::mat &Y, size_t maxIter = 20, double tol = 1e-3, double fraction = 8);
+// Same as above (for 2D maps), with points moved in parallel: each point is
+// pushed by the positions of the others as of the start of the iteration.
+// Results only depend on seed.
+arma::mat parallelForceScheme(const arma::mat &D, arma::mat &Y, size_t maxIter = 20, double tol = 1e-3, double fraction = 8, unsigned int seed = 1);
 
 arma::mat tSNE(const arma::mat &X, arma::uword k = 2, double perplexity = 30, arma::uword nIter = 1000);
 void tSNE(const arma::mat &X, arma::mat &Y, double perplexity = 30, arma::uword nIter = 1000);
+// Barnes-Hut approximation of the above for 2D maps: P is sparse (nearest
+// neighbors only) and repulsive forces come from a quadtree, accepting cells
+// smaller than theta times their distance. Y holds the initial map.
+void barnesHutTSNE(const arma::mat &X, arma::mat &Y, double perplexity = 30, arma::uword nIter = 1000, double theta = 0.5);
 
 } // namespace mp
 
@@ -0,0 +1,79 @@
+#include "mp.h"
+#include "pekalskaengine.h"
+
+#include <algorithm>
+
+// Rows of the map computed between checks for cancellation
+static const arma::uword CANCELLATION_BLOCK_SIZE = 4096;
+
+arma::mat mp::pekalska(const arma::mat &D, const arma::uvec &sampleIndices, const arma::mat &Ys)
+{
+    arma::mat Y(D.n_rows, Ys.n_cols);
+    mp::pekalska(D, sampleIndices, Ys, Y);
+    return Y;
+}
+
+void mp::pekalska(const arma::mat &D, const arma::uvec &sampleIndices, const arma::mat &Ys, arma::mat &Y)
+{
+    arma::mat V = arma::solve(D(sampleIndices, sampleIndices), Ys);
+
+    Y = D.cols(sampleIndices) * V;
+    Y.rows(sampleIndices) = Ys;
+}
+
+mp::PekalskaEngine::PekalskaEngine(const std::shared_ptr<const arma::mat> &X,
+                                   const arma::uvec &sampleIndices)
+    : m_sampleIndices(sampleIndices)
+{
+    // Same Gram matrix trick as in mp::dist(): |x - y|^2 = |x|^2 + |y|^2 - 2 x.y
+    const arma::mat Xs = X->rows(sampleIndices);
+    arma::vec norms = arma::sum(arma::square(*X), 1);
+    arma::rowvec sampleNorms = arma::sum(arma::square(Xs), 1).t();
+
+    m_Dns = *X * Xs.t();
+    m_Dns *= -2;
+    m_Dns.each_col() += norms;
+    m_Dns.each_row() += sampleNorms;
+    m_Dns = arma::sqrt(arma::clamp(m_Dns, 0, arma::datum::inf));
+
+    arma::mat Dss = m_Dns.rows(sampleIndices);
+    Dss.diag().zeros();
+    if (!arma::lu(m_L, m_U, m_P, Dss)
+        || arma::min(arma::abs(m_U.diag())) == 0) {
+        m_pinv = arma::pinv(Dss);
+    }
+}
+
+arma::mat mp::PekalskaEngine::project(const arma::mat &Ys) const
+{
+    arma::mat Y;
+    project(Ys, Y);
+    return Y;
+}
+
+bool mp::PekalskaEngine::project(const arma::mat &Ys,
+                                 arma::mat &Y,
+                                 const std::function<bool()> &cancelled) const
+{
+    arma::mat V;
+    if (m_pinv.n_elem > 0) {
+        V = m_pinv * Ys;
+    } else {
+        V = arma::solve(arma::trimatl(m_L), m_P * Ys);
+        V = arma::solve(arma::trimatu(m_U), V);
+    }
+
+    arma::uword n = m_Dns.n_rows;
+    Y.set_size(n, Ys.n_cols);
+    for (arma::uword lo = 0; lo < n; lo += CANCELLATION_BLOCK_SIZE) {
+        if (cancelled && cancelled()) {
+            return false;
+        }
+
+        arma::uword hi = std::min(n, lo + CANCELLATION_BLOCK_SIZE);
+        Y.rows(lo, hi - 1) = m_Dns.rows(lo, hi - 1) * V;
+    }
+
+    Y.rows(m_sampleIndices) = Ys;
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef PEKALSKAENGINE_H
+#define PEKALSKAENGINE_H
+
+#include <functional>
+#include <memory>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * Pekalska's projection: Y = D(:, s) * V, where V solves D(s, s) * V = Ys.
+ * Everything not depending on Ys (the distances from every point to the
+ * samples and the LU factors of the sample-sample distances) is computed
+ * once on construction, so each call to project() costs two triangular
+ * solves plus an n x s by s x 2 product.
+ */
+class PekalskaEngine
+{
+public:
+    PekalskaEngine(const std::shared_ptr<const arma::mat> &X,
+                   const arma::uvec &sampleIndices);
+
+    arma::mat project(const arma::mat &Ys) const;
+
+    // Gives up (returning false) as soon as cancelled() returns true, which is
+    // checked every few thousand rows
+    bool project(const arma::mat &Ys,
+                 arma::mat &Y,
+                 const std::function<bool()> &cancelled = std::function<bool()>()) const;
+
+private:
+    arma::uvec m_sampleIndices;
+
+    // Distances from every point (rows) to each sample (columns)
+    arma::mat m_Dns;
+
+    // P * D(s, s) = L * U; if D(s, s) is singular (e.g., repeated samples),
+    // its pseudoinverse is used instead
+    arma::mat m_L, m_U, m_P;
+    arma::mat m_pinv;
+};
+
+} // namespace mp
+
+#endif // PEKALSKAENGINE_H
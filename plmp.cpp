@@ -1,4 +1,5 @@
 #include "mp.h"
+#include "plmpengine.h"
 
 arma::mat mp::plmp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::mat &Ys)
 {
@@ -19,3 +20,46 @@ void mp::plmp(const arma::mat &X, const arma::uvec &sampleIndices, const arma::m
     Y = X * P;
     Y.rows(sampleIndices) = lYs;
 }
+
+mp::PLMPEngine::PLMPEngine(const std::shared_ptr<const arma::mat> &X,
+                           const arma::uvec &sampleIndices)
+    : m_X(X)
+    , m_sampleIndices(sampleIndices)
+{
+    arma::mat Xs = X->rows(sampleIndices);
+    m_mean = arma::mean(Xs);
+    Xs.each_row() -= m_mean;
+    m_XsT = Xs.t();
+
+    arma::mat XtX = m_XsT * Xs;
+    if (!arma::chol(m_R, XtX)) {
+        m_pinv = arma::pinv(XtX);
+    }
+}
+
+arma::mat mp::PLMPEngine::project(const arma::mat &Ys) const
+{
+    arma::mat Y;
+    project(Ys, Y);
+    return Y;
+}
+
+void mp::PLMPEngine::project(const arma::mat &Ys, arma::mat &Y) const
+{
+    arma::rowvec meanYs = arma::mean(Ys);
+    arma::mat lYs = Ys;
+    lYs.each_row() -= meanYs;
+
+    arma::mat P = m_XsT * lYs;
+    if (m_pinv.n_elem > 0) {
+        P = m_pinv * P;
+    } else {
+        P = arma::solve(arma::trimatl(m_R.t()), P);
+        P = arma::solve(arma::trimatu(m_R), P);
+    }
+
+    // (X - mean) P + mean(Ys), without making a centered copy of X
+    Y = *m_X * P;
+    Y.each_row() += meanYs - m_mean * P;
+    Y.rows(m_sampleIndices) = Ys;
+}
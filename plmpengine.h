@@ -0,0 +1,43 @@
+#ifndef PLMPENGINE_H
+#define PLMPENGINE_H
+
+#include <memory>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * PLMP: a single linear map P, fitted (by least squares) from the centered
+ * samples to their centered positions in Ys, applied to every point. The
+ * normal equations (Xs^T Xs) P = Xs^T Ys only change on the right-hand side
+ * as Ys changes, so the Cholesky factor of Xs^T Xs is computed once on
+ * construction and each call to project() costs two small triangular solves
+ * plus the n x d by d x 2 product.
+ */
+class PLMPEngine
+{
+public:
+    PLMPEngine(const std::shared_ptr<const arma::mat> &X,
+               const arma::uvec &sampleIndices);
+
+    arma::mat project(const arma::mat &Ys) const;
+    void project(const arma::mat &Ys, arma::mat &Y) const;
+
+private:
+    std::shared_ptr<const arma::mat> m_X;
+    arma::uvec m_sampleIndices;
+
+    // Centered samples (transposed) and their mean
+    arma::mat m_XsT;
+    arma::rowvec m_mean;
+
+    // Xs^T Xs = R^T R; with fewer (independent) samples than dimensions it is
+    // singular and its pseudoinverse is used instead
+    arma::mat m_R;
+    arma::mat m_pinv;
+};
+
+} // namespace mp
+
+#endif // PLMPENGINE_H
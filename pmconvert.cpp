@@ -0,0 +1,94 @@
+#include <iostream>
+#include <string>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+
+#include "datasetio.h"
+#include "mp.h"
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("pmconvert");
+    app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts .tbl datasets to the binary format loaded by pm.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("input", "Dataset filename (.tbl file)");
+    parser.addPositionalArgument("output", "Binary dataset filename (.pmd file)");
+
+    QCommandLineOption namesOption(QStringList() << "n" << "names",
+        "File with one column name per line.",
+        "filename");
+    parser.addOption(namesOption);
+    QCommandLineOption labelsOption(QStringList() << "l" << "labels",
+        "Use the last column as row labels instead of data.");
+    parser.addOption(labelsOption);
+    QCommandLineOption floatOption(QStringList() << "f" << "float",
+        "Store values as float32 (pm converts them back to float64 when loading).");
+    parser.addOption(floatOption);
+    QCommandLineOption rawOption(QStringList() << "r" << "raw",
+        "Do not standardize columns (pm will do it on every load).");
+    parser.addOption(rawOption);
+
+    parser.process(app);
+    QStringList args = parser.positionalArguments();
+    if (args.size() != 2) {
+        parser.showHelp(1);
+    }
+
+    arma::mat X;
+    if (!loadTable(args[0].toStdString(), X)) {
+        std::cerr << "Could not load dataset.\n";
+        return 1;
+    }
+
+    DatasetInfo info;
+    if (parser.isSet(labelsOption)) {
+        if (X.n_cols < 2) {
+            std::cerr << "Dataset has no columns left besides labels.\n";
+            return 1;
+        }
+
+        info.labels = X.col(X.n_cols - 1);
+        X.shed_col(X.n_cols - 1);
+    }
+
+    if (parser.isSet(namesOption)) {
+        QFile namesFile(parser.value(namesOption));
+        if (!namesFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            std::cerr << "Could not open column names file.\n";
+            return 1;
+        }
+
+        QTextStream in(&namesFile);
+        while (!in.atEnd()) {
+            QString name = in.readLine().trimmed();
+            if (!name.isEmpty()) {
+                info.columnNames.push_back(name.toStdString());
+            }
+        }
+        if (info.columnNames.size() != X.n_cols) {
+            std::cerr << "Number of column names does not match the dataset.\n";
+            return 1;
+        }
+    }
+
+    if (!parser.isSet(rawOption)) {
+        mp::standardize(X);
+        info.standardized = true;
+    }
+
+    BinaryDataType type = parser.isSet(floatOption) ? BinaryFloat32 : BinaryFloat64;
+    if (!saveBinaryDataset(args[1].toStdString(), X, info, type)) {
+        std::cerr << "Could not save dataset.\n";
+        return 1;
+    }
+
+    return 0;
+}
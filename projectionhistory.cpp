@@ -7,55 +7,182 @@
 
 #include "mp.h"
 #include "numericrange.h"
+#include "utils.h"
+#include "vptree.h"
 
-ProjectionHistory::ProjectionHistory(const arma::mat &X,
-                                     const arma::uvec &cpIndices)
+// Neighborhood size for neighborhood preservation, trustworthiness and
+// continuity
+static const arma::uword RANK_NEIGHBORS = 10;
+
+// Measures are updated (rather than recomputed) only when at most this
+// fraction of the points moved
+static const double INCREMENTAL_FRACTION = 0.25;
+
+ProjectionHistory::ProjectionHistory(const std::shared_ptr<const arma::mat> &X,
+                                     const arma::uvec &cpIndices,
+                                     arma::uword k,
+                                     const ArtifactCache *cache)
     : m_type(ObserverCurrent)
     , m_X(X)
     , m_cpIndices(cpIndices)
-    , m_rpIndices(X.n_rows - cpIndices.n_elem)
+    , m_rpIndices(X->n_rows - cpIndices.n_elem)
     , m_cpSelectionEmpty(true)
     , m_rpSelectionEmpty(true)
-    , m_values(X.n_rows)
-    , m_firstValues(X.n_rows)
-    , m_prevValues(X.n_rows)
+    , m_influences(X->n_rows)
+    , m_measure(0)
     , m_hasFirst(false)
     , m_hasPrev(false)
 {
-    m_distX = mp::dist(m_X);
+    QString distName = QString("distx-euclidean-%1")
+        .arg(sizeof(mp::DistMatrix::elem_type) * 8);
+    if (!cache || !cache->load(distName, m_distX)) {
+        mp::dist(*m_X, m_distX);
+        if (cache) {
+            cache->save(distName, m_distX);
+        }
+    }
+    m_maxX = m_distX.max();
+
+    m_engine.addMeasure(new AggregatedErrorMeasure);
+    m_engine.addMeasure(new NormalizedStressMeasure);
+    m_engine.addMeasure(new ShepardResidualMeasure);
+    m_engine.addMeasure(new KLDivergenceMeasure);
+    m_requested.assign(numMeasures(), false);
+
+    // Neighbors in the original space never change, so their ranks are only
+    // computed once per dataset
+    arma::umat nnX;
+    arma::uword extK = RankMeasures::extendedSize(RANK_NEIGHBORS, m_X->n_rows);
+    QString nnName = QString("knn-euclidean-%1").arg(extK);
+    if (!cache || !cache->load(nnName, nnX)) {
+        mp::knn(m_distX, extK, nnX);
+        if (cache) {
+            cache->save(nnName, nnX);
+        }
+    }
+    m_rankMeasures.reset(new RankMeasures(m_distX, nnX, RANK_NEIGHBORS));
+    m_nnX = nnX.head_rows(std::min(RANK_NEIGHBORS, arma::uword(nnX.n_rows)));
 
-    NumericRange<arma::uword> allIndices(0, m_X.n_rows);
+    NumericRange<arma::uword> allIndices(0, m_X->n_rows);
     std::set_symmetric_difference(allIndices.cbegin(), allIndices.cend(),
             m_cpIndices.cbegin(), m_cpIndices.cend(), m_rpIndices.begin());
 
-    computeAlphas();
+    if (k == 0 || k > m_cpIndices.n_elem) {
+        k = m_cpIndices.n_elem;
+    }
+
+    QString alphasName = QString("alphas-k%1-%2")
+        .arg(k).arg(ArtifactCache::hashOf(m_cpIndices));
+    if (!cache || !cache->load(alphasName, m_alphas)) {
+        computeAlphas(k);
+        if (cache) {
+            cache->save(alphasName, m_alphas);
+        }
+    }
 }
 
-void ProjectionHistory::computeAlphas()
+void ProjectionHistory::computeAlphas(arma::uword k)
 {
-    m_influences.set_size(m_X.n_rows);
-    m_alphas.set_size(m_rpIndices.n_elem, m_cpIndices.n_elem);
-
-    for (arma::uword i = 0; i < m_rpIndices.n_elem; i++) {
-        double sum = 0;
-        const arma::rowvec &x = m_X.row(m_rpIndices[i]);
-        for (arma::uword j = 0; j < m_cpIndices.n_elem; j++) {
-            double norm = arma::norm(x - m_X.row(m_cpIndices[j]));
-            m_alphas(i, j) = 1.0 / std::max(norm * norm, 1e-6);
-            sum += m_alphas(i, j);
+    arma::uword numCPs = m_cpIndices.n_elem;
+    if (k == 0 || k > numCPs) {
+        k = numCPs;
+    }
+
+    const arma::mat &X = *m_X;
+    if (k == numCPs) {
+        computeAllAlphas();
+        return;
+    }
+
+    // Each RP gets the k nearest CPs
+    mp::VPTree tree(X.rows(m_cpIndices));
+    int numRPs = uintToInt<arma::uword, int>(m_rpIndices.n_elem);
+    arma::umat locations(2, numRPs * k);
+    arma::vec values(numRPs * k);
+
+    #pragma omp parallel shared(X, tree, locations, values, numRPs, k)
+    {
+        arma::rowvec x;
+        arma::uvec neighbors;
+        arma::vec dist;
+
+        #pragma omp for
+        for (int i = 0; i < numRPs; i++) {
+            x = X.row(m_rpIndices[i]);
+            tree.knn(x, k, neighbors, dist);
+
+            double sum = 0;
+            for (arma::uword j = 0; j < k; j++) {
+                dist[j] = 1.0 / std::max(dist[j] * dist[j], 1e-6);
+                sum += dist[j];
+            }
+
+            for (arma::uword j = 0; j < k; j++) {
+                locations(0, i*k + j) = i;
+                locations(1, i*k + j) = neighbors[j];
+                values[i*k + j] = dist[j] / sum;
+            }
         }
+    }
+
+    m_alphas = arma::sp_mat(locations, values, m_rpIndices.n_elem, numCPs);
+}
+
+void ProjectionHistory::computeAllAlphas()
+{
+    // Every CP influences every RP, so there is nothing to search for: each
+    // RP goes over all CPs, filling its row of the alphas (as stored, column
+    // by column, in values)
+    const arma::mat &X = *m_X;
+    arma::uword numCPs = m_cpIndices.n_elem;
+    arma::uword numRPs = m_rpIndices.n_elem;
+    if (numCPs == 0 || numRPs == 0) {
+        m_alphas.zeros(numRPs, numCPs);
+        return;
+    }
+
+    arma::mat XcpT = X.rows(m_cpIndices).t();
+    arma::uword dim = X.n_cols;
+    arma::vec values(numRPs * numCPs);
+    int numRPsInt = uintToInt<arma::uword, int>(numRPs);
+
+    #pragma omp parallel shared(X, XcpT, values, dim, numCPs, numRPs, numRPsInt)
+    {
+        arma::vec x(dim);
+
+        #pragma omp for
+        for (int i = 0; i < numRPsInt; i++) {
+            x = X.row(m_rpIndices[i]).t();
+
+            double sum = 0;
+            for (arma::uword j = 0; j < numCPs; j++) {
+                const double *cp = XcpT.colptr(j);
+                double dist2 = 0;
+                for (arma::uword l = 0; l < dim; l++) {
+                    dist2 += (x[l] - cp[l]) * (x[l] - cp[l]);
+                }
+
+                double alpha = 1.0 / std::max(dist2, 1e-6);
+                values[j * numRPs + i] = alpha;
+                sum += alpha;
+            }
 
-        for (arma::uword j = 0; j < m_cpIndices.n_elem; j++) {
-            m_alphas(i, j) /= sum;
+            for (arma::uword j = 0; j < numCPs; j++) {
+                values[j * numRPs + i] /= sum;
+            }
         }
     }
+
+    arma::uvec rowIndices = arma::repmat(arma::regspace<arma::uvec>(0, numRPs - 1), numCPs, 1);
+    arma::uvec colPtrs = arma::regspace<arma::uvec>(0, numRPs, numRPs * numCPs);
+    m_alphas = arma::sp_mat(rowIndices, colPtrs, values, numRPs, numCPs);
 }
+
 void ProjectionHistory::undo()
 {
     if (m_hasPrev) {
         m_hasPrev = false;
         m_Y = m_prevY;
-        m_distY  = m_prevDistY;
         m_values = m_prevValues;
         updateUnreliability();
 
@@ -72,7 +199,6 @@ void ProjectionHistory::reset()
     if (m_hasFirst) {
         m_hasPrev = false;
         m_Y = m_firstY;
-        m_distY  = m_firstDistY;
         m_values = m_firstValues;
         updateUnreliability();
 
@@ -84,29 +210,162 @@ void ProjectionHistory::reset()
     }
 }
 
+std::string ProjectionHistory::measureName(arma::uword m) const
+{
+    arma::uword numDistortion = m_engine.numMeasures();
+    if (m < numDistortion) {
+        return m_engine.measure(m).name();
+    }
+
+    switch (m - numDistortion) {
+    case 0:
+        return "Neighborhood preservation";
+    case 1:
+        return "Trustworthiness";
+    default:
+        return "Continuity";
+    }
+}
+
+std::vector<bool> ProjectionHistory::activeMeasures() const
+{
+    QMutexLocker locker(&m_measuresMutex);
+    std::vector<bool> active(m_requested);
+    active[m_measure] = true;
+    return active;
+}
+
+void ProjectionHistory::requestMeasure(arma::uword m, bool requested)
+{
+    if (m >= numMeasures()) {
+        return;
+    }
+
+    {
+        QMutexLocker locker(&m_measuresMutex);
+        m_requested[m] = requested;
+    }
+    if (requested && m_hasFirst) {
+        fillMissingValues(m_Y, m_values);
+        fillMissingValues(m_firstY, m_firstValues);
+        if (m_hasPrev) {
+            fillMissingValues(m_prevY, m_prevValues);
+        }
+    }
+}
+
+void ProjectionHistory::measure(const arma::mat &Y, arma::mat &values) const
+{
+    DistortionState state;
+    measure(Y, activeMeasures(), values, arma::mat(), state);
+}
+
+void ProjectionHistory::measure(const arma::mat &Y,
+                                arma::mat &values,
+                                const arma::mat &prevY,
+                                DistortionState &state) const
+{
+    measure(Y, activeMeasures(), values, prevY, state);
+}
+
+void ProjectionHistory::measure(const arma::mat &Y,
+                                const std::vector<bool> &active,
+                                arma::mat &values,
+                                const arma::mat &prevY,
+                                DistortionState &state) const
+{
+    arma::uword numDistortion = m_engine.numMeasures();
+    std::vector<bool> activeDistortion(active.begin(),
+                                       active.begin() + numDistortion);
+    arma::mat distortion;
+    bool updated = false;
+    if (prevY.n_rows == Y.n_rows && prevY.n_cols == Y.n_cols) {
+        arma::uvec changedRows = arma::find(arma::any(Y != prevY, 1));
+        if (changedRows.n_elem <= INCREMENTAL_FRACTION * Y.n_rows) {
+            updated = m_engine.update(m_distX, prevY, Y, changedRows,
+                                      activeDistortion, distortion, m_maxX,
+                                      state);
+        }
+    }
+    if (!updated) {
+        m_engine.run(m_distX, Y, activeDistortion, distortion, m_maxX, &state);
+    }
+
+    arma::vec preservation(Y.n_rows), trustworthiness(Y.n_rows), continuity(Y.n_rows);
+    if (active[numDistortion]) {
+        mp::neighborhoodPreservation(m_nnX, Y, preservation);
+    } else {
+        preservation.fill(arma::datum::nan);
+    }
+    // Trustworthiness and continuity are computed together
+    if (active[numDistortion + 1] || active[numDistortion + 2]) {
+        m_rankMeasures->measure(Y, trustworthiness, continuity);
+    } else {
+        trustworthiness.fill(arma::datum::nan);
+        continuity.fill(arma::datum::nan);
+    }
+
+    values = arma::join_rows(distortion, preservation);
+    values = arma::join_rows(values, arma::join_rows(trustworthiness, continuity));
+}
+
+void ProjectionHistory::fillMissingValues(const arma::mat &Y, arma::mat &values) const
+{
+    std::vector<bool> missing = activeMeasures();
+    bool anyMissing = false;
+    for (arma::uword m = 0; m < missing.size(); m++) {
+        missing[m] = missing[m] && values.col(m).has_nan();
+        anyMissing = anyMissing || missing[m];
+    }
+    if (!anyMissing) {
+        return;
+    }
+
+    arma::mat computed;
+    DistortionState state;
+    measure(Y, missing, computed, arma::mat(), state);
+    for (arma::uword m = 0; m < missing.size(); m++) {
+        if (missing[m]) {
+            values.col(m) = computed.col(m);
+        }
+    }
+}
+
 void ProjectionHistory::addMap(const arma::mat &Y)
+{
+    arma::mat values;
+    measure(Y, values);
+    addMeasuredMap(Y, values);
+}
+
+void ProjectionHistory::addMeasuredMap(const arma::mat &Y, const arma::mat &values)
 {
     if (m_hasFirst) {
         m_hasPrev = true;
         m_prevY = m_Y;
-        m_prevDistY = m_distY;
         m_prevValues = m_values;
     }
 
     m_Y = Y;
-    m_distY = mp::dist(Y);
     updateUnreliability();
 
-    mp::aggregatedError(m_distX, m_distY, m_values);
-    qDebug("Aggr. error: min: %f, max: %f", m_values.min(), m_values.max());
+    // The current measure may have changed while the map was measured
+    m_values = values;
+    fillMissingValues(m_Y, m_values);
+    for (arma::uword m = 0; m < m_values.n_cols; m++) {
+        if (m_values.col(m).has_nan()) {
+            continue;
+        }
+        qDebug("%s: min: %f, max: %f", measureName(m).c_str(),
+               m_values.col(m).min(), m_values.col(m).max());
+    }
 
     if (!m_hasFirst) {
         m_hasFirst = true;
         m_firstY = m_Y;
-        m_firstDistY = m_distY;
         m_firstValues = m_values;
 
-        m_selection.assign(m_values.n_elem, false);
+        m_selection.assign(m_values.n_rows, false);
     }
 
     emit currentMapChanged(m_Y);
@@ -135,6 +394,32 @@ bool ProjectionHistory::setType(ObserverType type)
     return emitValuesChanged();
 }
 
+bool ProjectionHistory::setMeasure(arma::uword m)
+{
+    if (m >= numMeasures()) {
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&m_measuresMutex);
+        m_measure = m;
+    }
+    if (!m_hasFirst) {
+        return true;
+    }
+
+    // Maps so far were only evaluated by the measures active then
+    fillMissingValues(m_Y, m_values);
+    fillMissingValues(m_firstY, m_firstValues);
+    if (m_hasPrev) {
+        fillMissingValues(m_prevY, m_prevValues);
+    }
+    if (!m_cpSelectionEmpty || !m_rpSelectionEmpty) {
+        return true;
+    }
+    return emitValuesChanged();
+}
+
 void ProjectionHistory::setCPSelection(const std::vector<bool> &cpSelection)
 {
     if (cpSelection.size() != m_cpIndices.n_elem) {
@@ -159,13 +444,11 @@ void ProjectionHistory::cpSelectionPostProcess()
 {
     if (!m_cpSelectionEmpty) {
         // compute the influence of CP selection on each RP
-        for (arma::uword rp = 0; rp < m_rpIndices.n_elem; rp++) {
-            m_influences[m_rpIndices[rp]] = 0;
-            const arma::rowvec &row = m_alphas.row(rp);
-            for (auto cp: m_cpSelection) {
-                m_influences[m_rpIndices[rp]] += row[cp];
-            }
+        arma::vec selected(m_cpIndices.n_elem, arma::fill::zeros);
+        for (auto cp: m_cpSelection) {
+            selected[cp] = 1;
         }
+        m_influences(m_rpIndices) = m_alphas * selected;
 
         emit rpValuesChanged(m_influences(m_rpIndices), true);
     } else {
@@ -198,12 +481,11 @@ void ProjectionHistory::rpSelectionPostProcess()
 {
     if (!m_rpSelectionEmpty) {
         // compute how influent is each CP on RP selection
-        for (arma::uword cp = 0; cp < m_cpIndices.n_elem; cp++) {
-            m_influences[m_cpIndices[cp]] = 0;
-            for (auto rp: m_rpSelection) {
-                m_influences[m_cpIndices[cp]] += m_alphas(rp, cp);
-            }
+        arma::vec selected(m_rpIndices.n_elem, arma::fill::zeros);
+        for (auto rp: m_rpSelection) {
+            selected[rp] = 1;
         }
+        m_influences(m_cpIndices) = m_alphas.t() * selected;
 
         emit cpValuesChanged(m_influences(m_cpIndices), true);
     } else {
@@ -240,14 +522,15 @@ void ProjectionHistory::setSelection(const std::vector<bool> &selection)
 
 bool ProjectionHistory::emitValuesChanged() const
 {
+    arma::vec values = m_values.col(m_measure);
     switch (m_type) {
     case ObserverCurrent:
-        emit rpValuesChanged(m_values(m_rpIndices), false);
-        emit valuesChanged(m_values, false);
+        emit rpValuesChanged(values(m_rpIndices), false);
+        emit valuesChanged(values, false);
         return true;
     case ObserverDiffPrevious:
         if (m_hasPrev) {
-            arma::vec diff = m_values - m_prevValues;
+            arma::vec diff = values - m_prevValues.col(m_measure);
             emit rpValuesChanged(diff(m_rpIndices), true);
             emit valuesChanged(diff, false);
             return true;
@@ -255,7 +538,7 @@ bool ProjectionHistory::emitValuesChanged() const
         return false;
     case ObserverDiffFirst:
         if (m_hasFirst) {
-            arma::vec diff = m_values - m_firstValues;
+            arma::vec diff = values - m_firstValues.col(m_measure);
             emit rpValuesChanged(diff(m_rpIndices), true);
             emit valuesChanged(diff, true);
             return true;
@@ -279,7 +562,8 @@ void ProjectionHistory::setRewind(double t)
         return;
     }
 
-    arma::vec values = m_values * t + m_prevValues * (1.0 - t);
+    arma::vec values = m_values.col(m_measure) * t
+                     + m_prevValues.col(m_measure) * (1.0 - t);
     // emit cpValuesRewound(values(m_cpIndices));
     emit rpValuesRewound(values(m_rpIndices));
     emit valuesRewound(values);
@@ -287,6 +571,27 @@ void ProjectionHistory::setRewind(double t)
 
 void ProjectionHistory::updateUnreliability()
 {
-    m_unreliability.copy_size(m_alphas);
-    m_unreliability = m_alphas % m_distY(m_rpIndices, m_cpIndices);
+    // Distances between RPs and CPs are computed directly from the map, and
+    // only where CPs have any influence (the nonzeros of alphas, in order)
+    m_alphas.sync();
+    const arma::sp_mat &alphas = m_alphas;
+    arma::vec values(alphas.n_nonzero);
+    int numCPs = uintToInt<arma::uword, int>(m_cpIndices.n_elem);
+
+    #pragma omp parallel for shared(alphas, values, numCPs)
+    for (int j = 0; j < numCPs; j++) {
+        double cx = m_Y(m_cpIndices[j], 0);
+        double cy = m_Y(m_cpIndices[j], 1);
+        for (arma::uword l = alphas.col_ptrs[j]; l < alphas.col_ptrs[j + 1]; l++) {
+            arma::uword i = alphas.row_indices[l];
+            double dx = m_Y(m_rpIndices[i], 0) - cx;
+            double dy = m_Y(m_rpIndices[i], 1) - cy;
+            values[l] = alphas.values[l] * sqrt(dx*dx + dy*dy);
+        }
+    }
+
+    arma::uvec rowIndices(alphas.row_indices, alphas.n_nonzero);
+    arma::uvec colPtrs(alphas.col_ptrs, alphas.n_cols + 1);
+    m_unreliability = arma::sp_mat(rowIndices, colPtrs, values,
+                                   alphas.n_rows, alphas.n_cols);
 }
@@ -1,12 +1,20 @@
 #ifndef PROJECTIONHISTORY_H
 #define PROJECTIONHISTORY_H
 
+#include <memory>
+#include <string>
 #include <vector>
 
+#include <QMutex>
 #include <QObject>
 
 #include <armadillo>
 
+#include "artifactcache.h"
+#include "distmatrix.h"
+#include "distortionengine.h"
+#include "rankmeasures.h"
+
 class ProjectionHistory
     : public QObject
 {
@@ -18,12 +26,18 @@ public:
         ObserverDiffFirst
     };
 
-    ProjectionHistory(const arma::mat &X, const arma::uvec &cpIndices);
+    // Distances and alphas are taken from (and stored in) cache, if given
+    ProjectionHistory(const std::shared_ptr<const arma::mat> &X,
+                      const arma::uvec &cpIndices,
+                      arma::uword k = 0,
+                      const ArtifactCache *cache = nullptr);
 
     const arma::mat &Y() const             { return m_Y; }
     const arma::mat &firstY() const        { return m_firstY; }
     const arma::mat &prevY() const         { return m_prevY; }
-    const arma::mat &unreliability() const { return m_unreliability; }
+    // Same sparsity as the alphas: only RP/CP pairs where the CP has any
+    // influence on the RP (RPs are rows, CPs columns)
+    const arma::sp_mat &unreliability() const { return m_unreliability; }
 
     const arma::uvec &cpIndices() const { return m_cpIndices; }
     const arma::uvec &rpIndices() const { return m_rpIndices; }
@@ -31,9 +45,32 @@ public:
     bool hasFirst() const { return m_hasFirst; }
     bool hasPrev() const  { return m_hasPrev; }
 
+    // Maps are only evaluated by the active measures: the current one (the
+    // one observed and emitted) and those requested with requestMeasure().
+    // values() has one column per measure, NaN for those not computed.
+    arma::uword numMeasures() const { return m_engine.numMeasures() + 3; }
+    std::string measureName(arma::uword m) const;
+    const arma::mat &values() const { return m_values; }
+    arma::vec values(arma::uword m) const { return m_values.col(m); }
+    arma::uword currentMeasure() const { return m_measure; }
+    std::vector<bool> activeMeasures() const;
+    void requestMeasure(arma::uword m, bool requested = true);
+
     void undo();
     void reset();
 
+    // Computes the measures of a map (without adding it); can be called from
+    // any thread
+    void measure(const arma::mat &Y, arma::mat &values) const;
+
+    // Same as above, for callers that measure maps in a sequence: state holds
+    // what is needed to update the measures of prevY (the map last measured
+    // with this state) when only a few points moved
+    void measure(const arma::mat &Y,
+                 arma::mat &values,
+                 const arma::mat &prevY,
+                 DistortionState &state) const;
+
 signals:
     void undoPerformed() const;
     void resetPerformed() const;
@@ -54,8 +91,10 @@ signals:
 
 public slots:
     void addMap(const arma::mat &Y);
+    void addMeasuredMap(const arma::mat &Y, const arma::mat &values);
 
     bool setType(ObserverType type);
+    bool setMeasure(arma::uword m);
     void setCPSelection(const std::vector<bool> &cpSelection);
     void setRPSelection(const std::vector<bool> &rpSelection);
     void setSelection(const std::vector<bool> &selection);
@@ -63,6 +102,16 @@ public slots:
     void setRewind(double t);
 
 private:
+    void measure(const arma::mat &Y,
+                 const std::vector<bool> &active,
+                 arma::mat &values,
+                 const arma::mat &prevY,
+                 DistortionState &state) const;
+
+    // Computes the active measures missing from values (a map's values,
+    // measured when they were not active)
+    void fillMissingValues(const arma::mat &Y, arma::mat &values) const;
+
     bool emitValuesChanged() const;
     void updateUnreliability();
 
@@ -71,21 +120,37 @@ private:
 
     ObserverType m_type;
 
-    arma::mat m_X, m_Y, m_firstY, m_prevY;
-    arma::mat m_distX, m_distY, m_firstDistY, m_prevDistY;
-    arma::mat m_unreliability;
+    std::shared_ptr<const arma::mat> m_X;
+    arma::mat m_Y, m_firstY, m_prevY;
+    mp::DistMatrix m_distX;
+    double m_maxX;
+    arma::sp_mat m_unreliability;
     arma::uvec m_cpIndices, m_rpIndices;
 
     bool m_cpSelectionEmpty, m_rpSelectionEmpty;
     std::vector<int> m_cpSelection, m_rpSelection;
     std::vector<bool> m_selection;
 
-    // alpha(i, j): the influence CP j has on RP i
-    void computeAlphas();
-    arma::mat m_alphas, m_influences;
-
-    // TODO: one per implemented measure
-    arma::vec m_values, m_firstValues, m_prevValues;
+    // alpha(i, j): the influence CP j has on RP i; if k > 0, only the k
+    // nearest CPs of each RP have any influence on it
+    void computeAlphas(arma::uword k);
+    void computeAllAlphas();
+    arma::sp_mat m_alphas;
+    arma::vec m_influences;
+
+    DistortionEngine m_engine;
+    std::unique_ptr<RankMeasures> m_rankMeasures;
+
+    // The RANK_NEIGHBORS nearest neighbors of each point in X (one column
+    // per point), for neighborhood preservation
+    arma::umat m_nnX;
+    arma::uword m_measure;
+    std::vector<bool> m_requested;
+
+    // Guards m_measure and m_requested, which are read when measuring maps
+    // from other threads
+    mutable QMutex m_measuresMutex;
+    arma::mat m_values, m_firstValues, m_prevValues;
 
     bool m_hasFirst, m_hasPrev;
 };
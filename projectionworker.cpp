@@ -0,0 +1,135 @@
+#include "projectionworker.h"
+
+#include <QMetaType>
+
+ProjectionWorker::ProjectionWorker(ManipulationHandler *handler,
+                                   const ProjectionHistory *history)
+    : m_handler(handler)
+    , m_history(history)
+    , m_hasPending(false)
+    , m_hasPendingTechnique(false)
+    , m_stop(false)
+    , m_generation(0)
+{
+    // Needed to send results across threads
+    qRegisterMetaType<arma::mat>("arma::mat");
+    qRegisterMetaType<arma::uvec>("arma::uvec");
+    qRegisterMetaType<arma::vec>("arma::vec");
+
+    // This object lives in the thread that created it, so results emitted from
+    // run() are queued back to it
+    connect(this, &ProjectionWorker::mapComputed,
+            this, &ProjectionWorker::deliver, Qt::QueuedConnection);
+}
+
+ProjectionWorker::~ProjectionWorker()
+{
+    m_mutex.lock();
+    m_stop = true;
+    m_condition.wakeOne();
+    m_mutex.unlock();
+
+    wait();
+}
+
+void ProjectionWorker::setCP(const arma::mat &Ys)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pendingYs = Ys;
+    m_hasPending = true;
+    m_generation++;
+    m_condition.wakeOne();
+}
+
+void ProjectionWorker::setTechnique(ManipulationHandler::Technique technique,
+                                    const arma::mat &Ys)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pendingTechnique = technique;
+    m_hasPendingTechnique = true;
+    m_pendingYs = Ys;
+    m_hasPending = true;
+    m_generation++;
+    m_condition.wakeOne();
+}
+
+bool ProjectionWorker::isStale(unsigned int generation)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stop || generation != m_generation;
+}
+
+void ProjectionWorker::run()
+{
+    forever {
+        m_mutex.lock();
+        while (!m_hasPending && !m_stop) {
+            m_condition.wait(&m_mutex);
+        }
+        if (m_stop) {
+            m_mutex.unlock();
+            return;
+        }
+
+        arma::mat Ys = m_pendingYs;
+        unsigned int generation = m_generation;
+        bool switchTechnique = m_hasPendingTechnique;
+        ManipulationHandler::Technique technique = m_pendingTechnique;
+        m_hasPending = false;
+        m_hasPendingTechnique = false;
+        m_mutex.unlock();
+
+        if (switchTechnique) {
+            m_handler->setTechnique(technique);
+        }
+
+        arma::mat Y;
+        arma::uvec changedRows;
+        auto cancelled = [this, generation]() { return isStale(generation); };
+        bool projected = m_handler->project(Ys, Y, changedRows, cancelled);
+
+        m_mutex.lock();
+        if (projected) {
+            // The handler now projects relative to Y, whether or not it is
+            // emitted
+            m_undeliveredRows = arma::unique(arma::join_cols(m_undeliveredRows, changedRows));
+            m_projectedY = Y;
+        } else {
+            // Either cancelled (and stale), or no CP moved since the last map
+            // projected; if that map was dropped, it is still the one to emit
+            Y = m_projectedY;
+        }
+        changedRows = m_undeliveredRows;
+        m_mutex.unlock();
+        if (changedRows.is_empty() || isStale(generation)) {
+            continue;
+        }
+
+        arma::mat values;
+        m_history->measure(Y, values, m_measuredY, m_state);
+        m_measuredY = Y;
+        if (isStale(generation)) {
+            continue;
+        }
+
+        emit mapComputed(Y, values, changedRows, generation);
+    }
+}
+
+void ProjectionWorker::deliver(const arma::mat &Y,
+                               const arma::mat &values,
+                               const arma::uvec &changedRows,
+                               unsigned int generation)
+{
+    // A newer CP map may have been requested while this one was in the queue.
+    // Requests also come from this thread, so none can sneak in between.
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_stop || generation != m_generation) {
+            return;
+        }
+        m_undeliveredRows.reset();
+    }
+
+    emit mapChanged(Y, values, changedRows);
+}
@@ -0,0 +1,81 @@
+#ifndef PROJECTIONWORKER_H
+#define PROJECTIONWORKER_H
+
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QWaitCondition>
+#include <armadillo>
+
+#include "manipulationhandler.h"
+#include "projectionhistory.h"
+
+/*
+ * Runs the project -> measure pipeline for new CP maps in its own thread.
+ * Only the latest CP map matters: a new one supersedes whatever is being
+ * computed, whose results are then dropped. Results are delivered back to
+ * the thread this object lives in, tagged with the generation of the CP map
+ * they came from, and only emitted (in mapChanged()) if no newer CP map was
+ * requested since. The rows changed by maps that were dropped are reported
+ * along with the next map that is emitted, so that changedRows is always
+ * relative to the last map emitted. Technique switches are also applied in
+ * the worker thread, so the handler is never used by two threads at once.
+ */
+class ProjectionWorker
+    : public QThread
+{
+    Q_OBJECT
+public:
+    ProjectionWorker(ManipulationHandler *handler, const ProjectionHistory *history);
+    ~ProjectionWorker();
+
+    void run();
+
+signals:
+    void mapChanged(const arma::mat &Y,
+                    const arma::mat &values,
+                    const arma::uvec &changedRows) const;
+
+    // Emitted from the worker thread; see deliver()
+    void mapComputed(const arma::mat &Y,
+                     const arma::mat &values,
+                     const arma::uvec &changedRows,
+                     unsigned int generation) const;
+
+public slots:
+    void setCP(const arma::mat &Ys);
+
+    // Switches the handler to technique, then projects Ys with it
+    void setTechnique(ManipulationHandler::Technique technique, const arma::mat &Ys);
+
+private slots:
+    void deliver(const arma::mat &Y,
+                 const arma::mat &values,
+                 const arma::uvec &changedRows,
+                 unsigned int generation);
+
+private:
+    bool isStale(unsigned int generation);
+
+    ManipulationHandler *m_handler;
+    const ProjectionHistory *m_history;
+
+    // Last map measured (only touched by the worker thread), so measures of
+    // the next one can be updated incrementally
+    arma::mat m_measuredY;
+    DistortionState m_state;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    arma::mat m_pendingYs;
+    ManipulationHandler::Technique m_pendingTechnique;
+    bool m_hasPending, m_hasPendingTechnique, m_stop;
+    unsigned int m_generation;
+
+    // Rows changed since the last map emitted, and the last map projected
+    // (emitted or not, which is the case if any rows are undelivered)
+    arma::uvec m_undeliveredRows;
+    arma::mat m_projectedY;
+};
+
+#endif // PROJECTIONWORKER_H
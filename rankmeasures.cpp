@@ -0,0 +1,141 @@
+#include "rankmeasures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "grid2d.h"
+#include "utils.h"
+
+// Neighbors kept (and searched in 2D) per point, as a multiple of k
+static const arma::uword EXTENDED_FACTOR = 4;
+
+RankMeasures::RankMeasures(const mp::DistMatrix &distX,
+                           const arma::umat &nnX,
+                           arma::uword k)
+    : m_n(distX.size())
+    , m_k(std::min(k, m_n > 0 ? m_n - 1 : 0))
+    , m_extK(std::min(extendedSize(k, m_n), arma::uword(nnX.n_rows)))
+    , m_neighbors(m_extK * m_n)
+    , m_ranks(m_extK * m_n)
+{
+    int n = uintToInt<arma::uword, int>(m_n);
+
+    #pragma omp parallel shared(nnX, n)
+    {
+        std::vector<std::pair<uint32_t, uint16_t>> column(m_extK);
+
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            for (arma::uword r = 0; r < m_extK; r++) {
+                column[r] = std::make_pair(uint32_t(nnX(r, i)), uint16_t(r + 1));
+            }
+            std::sort(column.begin(), column.end());
+
+            for (arma::uword r = 0; r < m_extK; r++) {
+                m_neighbors[i * m_extK + r] = column[r].first;
+                m_ranks[i * m_extK + r] = column[r].second;
+            }
+        }
+    }
+}
+
+arma::uword RankMeasures::extendedSize(arma::uword k, arma::uword n)
+{
+    arma::uword size = std::min(EXTENDED_FACTOR * k, n > 0 ? n - 1 : 0);
+    return std::min(size, arma::uword(std::numeric_limits<uint16_t>::max()));
+}
+
+arma::uword RankMeasures::rankX(arma::uword i, arma::uword j) const
+{
+    const uint32_t *begin = m_neighbors.data() + i * m_extK;
+    const uint32_t *end = begin + m_extK;
+    const uint32_t *it = std::lower_bound(begin, end, uint32_t(j));
+    return (it != end && *it == j) ? m_ranks[it - m_neighbors.data()] : 0;
+}
+
+void RankMeasures::measure(const arma::mat &Y,
+                           arma::vec &trustworthiness,
+                           arma::vec &continuity) const
+{
+    trustworthiness.set_size(m_n);
+    continuity.set_size(m_n);
+    if (m_k == 0) {
+        trustworthiness.ones();
+        continuity.ones();
+        return;
+    }
+
+    // Normalization making both measures lie in [0, 1]
+    double n = double(m_n), k = double(m_k);
+    double norm = (k < n / 2) ? 2.0 / (k * (2*n - 3*k - 1))
+                              : 2.0 / ((n - k) * (n - k - 1));
+    if (!std::isfinite(norm)) {
+        norm = 0;
+    }
+
+    mp::Grid2D grid(Y);
+    arma::uword extK = std::max(m_extK, m_k);
+    const double *y0 = Y.colptr(0);
+    const double *y1 = Y.colptr(1);
+    int numPoints = uintToInt<arma::uword, int>(m_n);
+
+    // Penalties of points beyond the extended neighborhoods, whose ranks are
+    // taken to be the first past them
+    double missingX = std::max(double(m_extK + 1) - k, 0.0);
+    double missingY = std::max(double(extK + 1) - k, 0.0);
+
+    #pragma omp parallel shared(grid, trustworthiness, continuity, y0, y1, norm, extK, numPoints, missingX, missingY)
+    {
+        arma::uvec nnY(extK);
+        arma::vec distY(extK);
+        std::vector<std::pair<arma::uword, arma::uword>> ranksY(extK);
+
+        #pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < numPoints; i++) {
+            grid.knn(y0[i], y1[i], extK, nnY.memptr(), distY.memptr(), i);
+
+            // Trustworthiness: 2D neighbors which are not neighbors in the
+            // original space are penalized by their rank there
+            double sum = 0;
+            for (arma::uword l = 0; l < m_k; l++) {
+                arma::uword r = rankX(i, nnY[l]);
+                if (r == 0) {
+                    sum += missingX;
+                } else if (r > m_k) {
+                    sum += r - m_k;
+                }
+            }
+            trustworthiness[i] = 1 - norm * sum;
+
+            // Continuity: neighbors in the original space which are not 2D
+            // neighbors are penalized by their rank in the map
+            for (arma::uword l = 0; l < extK; l++) {
+                ranksY[l] = std::make_pair(nnY[l], l + 1);
+            }
+            std::sort(ranksY.begin(), ranksY.end());
+
+            sum = 0;
+            const uint32_t *neighbors = m_neighbors.data() + i * m_extK;
+            const uint16_t *ranks = m_ranks.data() + i * m_extK;
+            for (arma::uword l = 0; l < m_extK; l++) {
+                if (ranks[l] > m_k) {
+                    continue;
+                }
+
+                arma::uword j = neighbors[l];
+                auto it = std::lower_bound(ranksY.begin(), ranksY.end(),
+                                           std::make_pair(j, arma::uword(0)));
+                if (it != ranksY.end() && it->first == j) {
+                    if (it->second > m_k) {
+                        sum += it->second - m_k;
+                    }
+                } else {
+                    sum += missingY;
+                }
+            }
+            continuity[i] = 1 - norm * sum;
+        }
+    }
+}
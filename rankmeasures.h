@@ -0,0 +1,48 @@
+#ifndef RANKMEASURES_H
+#define RANKMEASURES_H
+
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#include "distmatrix.h"
+
+/*
+ * Per-point trustworthiness and continuity of maps, for neighborhoods of size
+ * k. Both need the rank of points in the neighborhood of each point in one
+ * space, as seen from the other space. Ranks in the original space are only
+ * computed once: each point keeps its extendedSize() nearest neighbors (and
+ * their ranks) in compact arrays. Per map, only as many 2D neighbors are
+ * searched (with a Grid2D). Points beyond the extended neighborhood in either
+ * space are given the rank just past it, as in the windowed definitions of
+ * both measures; the penalty of such points is thus a lower bound, which is
+ * what keeps measuring a map O(n k) even when the map is poor.
+ */
+class RankMeasures
+{
+public:
+    // nnX holds (at least) the extendedSize() nearest neighbors of each point,
+    // one point per column, nearest first (see mp::knn)
+    RankMeasures(const mp::DistMatrix &distX, const arma::umat &nnX, arma::uword k);
+
+    static arma::uword extendedSize(arma::uword k, arma::uword n);
+
+    arma::uword k() const { return m_k; }
+
+    void measure(const arma::mat &Y, arma::vec &trustworthiness, arma::vec &continuity) const;
+
+private:
+    // Rank of j among the neighbors of i in the original space, or 0 if j is
+    // beyond the extended neighborhood
+    arma::uword rankX(arma::uword i, arma::uword j) const;
+
+    arma::uword m_n, m_k, m_extK;
+
+    // Column i (of m_extK elements) has the extended neighbors of i sorted by
+    // index, along with their ranks
+    std::vector<uint32_t> m_neighbors;
+    std::vector<uint16_t> m_ranks;
+};
+
+#endif // RANKMEASURES_H
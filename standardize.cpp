@@ -0,0 +1,72 @@
+#include "mp.h"
+
+#include <cmath>
+
+#include "utils.h"
+
+// Welford's online algorithm: mean and (sample) standard deviation in a single
+// pass, without the cancellation problems of accumulating squares
+static void columnStats(const double *x, arma::uword n, double &mean, double &sd)
+{
+    mean = 0;
+    double m2 = 0;
+    for (arma::uword i = 0; i < n; i++) {
+        double delta = x[i] - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (x[i] - mean);
+    }
+
+    sd = n > 1 ? sqrt(m2 / (n - 1)) : 0;
+}
+
+void mp::standardize(arma::mat &X, arma::rowvec &means, arma::rowvec &sds)
+{
+    means.set_size(X.n_cols);
+    sds.set_size(X.n_cols);
+
+    int n = uintToInt<arma::uword, int>(X.n_cols);
+
+    #pragma omp parallel for shared(X, means, sds, n)
+    for (int j = 0; j < n; j++) {
+        double *x = X.colptr(j);
+        columnStats(x, X.n_rows, means[j], sds[j]);
+
+        // Constant columns carry no information; they become all zeros
+        // instead of NaNs
+        if (sds[j] == 0) {
+            sds[j] = 1;
+        }
+
+        double mean = means[j], sd = sds[j];
+        for (arma::uword i = 0; i < X.n_rows; i++) {
+            x[i] = (x[i] - mean) / sd;
+        }
+    }
+}
+
+void mp::standardize(arma::mat &X)
+{
+    arma::rowvec means, sds;
+    standardize(X, means, sds);
+}
+
+arma::mat mp::standardized(const arma::mat &X, arma::rowvec &means, arma::rowvec &sds)
+{
+    arma::mat Z(X);
+    standardize(Z, means, sds);
+    return Z;
+}
+
+void mp::applyStandardization(arma::mat &X, const arma::rowvec &means, const arma::rowvec &sds)
+{
+    int n = uintToInt<arma::uword, int>(X.n_cols);
+
+    #pragma omp parallel for shared(X, means, sds, n)
+    for (int j = 0; j < n; j++) {
+        double *x = X.colptr(j);
+        double mean = means[j], sd = sds[j];
+        for (arma::uword i = 0; i < X.n_rows; i++) {
+            x[i] = (x[i] - mean) / sd;
+        }
+    }
+}
@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
+
+#include "utils.h"
 
 static const double ETA = 500;
 static const double MIN_GAIN           = 1e-2;
@@ -15,8 +18,14 @@ static const int MOMENTUM_THRESHOLD_ITER     = 20;
 static const int EXAGGERATION_THRESHOLD_ITER = 100;
 static const int MAX_BINSEARCH_TRIES         = 50;
 
+// Barnes-Hut: neighbors per point in the sparse P, relative to perplexity, and
+// maximum quadtree depth (only reached with (nearly) coincident points)
+static const double NEIGHBORS_PER_PERPLEXITY = 3;
+static const int MAX_QUADTREE_DEPTH          = 32;
+
 static void calcP(const arma::mat &X, arma::mat &P, double perplexity, double tol = 1e-5);
 static double hBeta(const arma::rowvec &Di, double beta, arma::rowvec &Pi);
+static void calcSparseP(const arma::mat &X, arma::sp_mat &P, double perplexity, double tol = 1e-5);
 
 arma::mat mp::tSNE(const arma::mat &X, arma::uword k, double perplexity, arma::uword nIter)
 {
@@ -125,3 +134,274 @@ static inline double hBeta(const arma::rowvec &Di, double beta, arma::rowvec &Pi
     Pi /= sumPi;
     return h;
 }
+
+/*
+ * Quadtree over the points of a 2D map, built top-down by partitioning an
+ * index array, so that each node covers a contiguous range of indices. Each
+ * node keeps the center of mass of its points, which is what stands in for
+ * all of them when the node is far enough from the query point.
+ */
+class QuadTree
+{
+public:
+    QuadTree(const arma::mat &Y)
+        : m_Y(Y)
+        , m_indices(Y.n_rows)
+    {
+        for (arma::uword i = 0; i < m_indices.size(); i++) {
+            m_indices[i] = i;
+        }
+        m_nodes.reserve(2 * Y.n_rows);
+
+        double minX = Y.col(0).min(), maxX = Y.col(0).max();
+        double minY = Y.col(1).min(), maxY = Y.col(1).max();
+        double width = std::max(maxX - minX, maxY - minY);
+        build(minX, minY, width, 0, m_indices.size(), 0);
+    }
+
+    // Adds the repulsive force on point i (times Z^2, the sum of all
+    // unnormalized q's squared) to force and returns its part of Z
+    double repulsion(arma::uword i, double theta, double force[2]) const {
+        return repulsion(0, i, theta * theta, force);
+    }
+
+private:
+    struct Node {
+        double cx, cy, width;
+        arma::uword lo, hi;
+        int children[4];
+    };
+
+    int build(double x, double y, double width, arma::uword lo, arma::uword hi, int depth) {
+        int node = m_nodes.size();
+        Node n = { 0, 0, width, lo, hi, { -1, -1, -1, -1 } };
+        for (arma::uword l = lo; l < hi; l++) {
+            n.cx += m_Y(m_indices[l], 0);
+            n.cy += m_Y(m_indices[l], 1);
+        }
+        n.cx /= hi - lo;
+        n.cy /= hi - lo;
+        m_nodes.push_back(n);
+        if (hi - lo == 1 || depth == MAX_QUADTREE_DEPTH) {
+            return node;
+        }
+
+        // Quadrants: [left bottom, right bottom, left top, right top]
+        double half = width / 2;
+        auto first = m_indices.begin();
+        auto top = std::partition(first + lo, first + hi,
+                [&](arma::uword i) { return m_Y(i, 1) < y + half; });
+        auto bottomRight = std::partition(first + lo, top,
+                [&](arma::uword i) { return m_Y(i, 0) < x + half; });
+        auto topRight = std::partition(top, first + hi,
+                [&](arma::uword i) { return m_Y(i, 0) < x + half; });
+
+        arma::uword bounds[5] = {
+            lo,
+            arma::uword(bottomRight - first),
+            arma::uword(top - first),
+            arma::uword(topRight - first),
+            hi
+        };
+        for (int q = 0; q < 4; q++) {
+            if (bounds[q] < bounds[q + 1]) {
+                int child = build(x + (q % 2) * half, y + (q / 2) * half, half,
+                                  bounds[q], bounds[q + 1], depth + 1);
+                m_nodes[node].children[q] = child;
+            }
+        }
+        return node;
+    }
+
+    double repulsion(int node, arma::uword i, double theta2, double force[2]) const {
+        const Node &n = m_nodes[node];
+        double yx = m_Y(i, 0), yy = m_Y(i, 1);
+        double dx = yx - n.cx, dy = yy - n.cy;
+        double d2 = dx*dx + dy*dy;
+        bool leaf = n.children[0] < 0 && n.children[1] < 0
+                 && n.children[2] < 0 && n.children[3] < 0;
+
+        if (!leaf && n.width * n.width < theta2 * d2) {
+            double q = 1 / (1 + d2);
+            double mass = double(n.hi - n.lo);
+            force[0] += mass * q * q * dx;
+            force[1] += mass * q * q * dy;
+            return mass * q;
+        }
+
+        double sumQ = 0;
+        if (leaf) {
+            for (arma::uword l = n.lo; l < n.hi; l++) {
+                arma::uword j = m_indices[l];
+                if (j == i) {
+                    continue;
+                }
+
+                dx = yx - m_Y(j, 0);
+                dy = yy - m_Y(j, 1);
+                double q = 1 / (1 + dx*dx + dy*dy);
+                force[0] += q * q * dx;
+                force[1] += q * q * dy;
+                sumQ += q;
+            }
+        } else {
+            for (int q = 0; q < 4; q++) {
+                if (n.children[q] >= 0) {
+                    sumQ += repulsion(n.children[q], i, theta2, force);
+                }
+            }
+        }
+        return sumQ;
+    }
+
+    const arma::mat &m_Y;
+    std::vector<arma::uword> m_indices;
+    std::vector<Node> m_nodes;
+};
+
+void mp::barnesHutTSNE(const arma::mat &X, arma::mat &Y, double perplexity, arma::uword nIter, double theta)
+{
+    if (Y.n_cols != 2) {
+        mp::tSNE(X, Y, perplexity, nIter);
+        return;
+    }
+
+    arma::uword n = X.n_rows;
+    arma::mat dY(n, 2),
+              gains(n, 2, arma::fill::ones),
+              iY(n, 2, arma::fill::zeros);
+
+    // The attraction loop reads the CSC arrays of P directly, which are only
+    // valid once P is synced
+    arma::sp_mat P;
+    calcSparseP(X, P, perplexity);
+    P.sync();
+    double exaggeration = EARLY_EXAGGERATION;
+
+    int nInt = uintToInt<arma::uword, int>(n);
+    arma::mat attraction(n, 2), repulsion(n, 2);
+    arma::vec sumQ(n);
+    for (arma::uword iter = 0; iter < nIter; iter++) {
+        QuadTree tree(Y);
+
+        #pragma omp parallel for shared(P, Y, tree, attraction, repulsion, sumQ, nInt, theta)
+        for (int i = 0; i < nInt; i++) {
+            // Attraction: sum_j p_ij q_ij Z (y_i - y_j), P being symmetric
+            double fx = 0, fy = 0;
+            for (arma::uword l = P.col_ptrs[i]; l < P.col_ptrs[i + 1]; l++) {
+                arma::uword j = P.row_indices[l];
+                double dx = Y(i, 0) - Y(j, 0);
+                double dy = Y(i, 1) - Y(j, 1);
+                double pq = P.values[l] / (1 + dx*dx + dy*dy);
+                fx += pq * dx;
+                fy += pq * dy;
+            }
+            attraction(i, 0) = fx;
+            attraction(i, 1) = fy;
+
+            double force[2] = { 0, 0 };
+            sumQ[i] = tree.repulsion(i, theta, force);
+            repulsion(i, 0) = force[0];
+            repulsion(i, 1) = force[1];
+        }
+
+        // Same gradient (up to a constant factor) as in mp::tSNE()
+        double Z = std::max(arma::accu(sumQ), EPSILON);
+        dY = exaggeration * attraction - repulsion / Z;
+
+        double momentum = (iter < MOMENTUM_THRESHOLD_ITER) ? INITIAL_MOMENTUM : FINAL_MOMENTUM;
+        gains = (gains +       GAIN_FRACTION) % ((dY > 0) != (iY > 0))
+              + (gains * (1 - GAIN_FRACTION)) % ((dY > 0) == (iY > 0));
+        gains.transform([](double v) { return std::max(v, MIN_GAIN); });
+        iY = momentum * iY - ETA * (gains % dY);
+        Y += iY;
+        Y.each_row() -= mean(Y, 0);
+
+        if (iter == EXAGGERATION_THRESHOLD_ITER) {
+            exaggeration = 1; // remove early exaggeration
+        }
+    }
+}
+
+/*
+ * Sparse counterpart of calcP(): the distribution of each point only covers
+ * its nearest neighbors (3 * perplexity of them) and is stored in its column
+ * of P. Points are calibrated in parallel. Unlike calcP(), the result is
+ * also symmetrized and normalized (as mp::tSNE() does with the dense P).
+ */
+static void calcSparseP(const arma::mat &X, arma::sp_mat &P, double perplexity, double tol)
+{
+    arma::uword n = X.n_rows;
+    arma::uword k = std::min(arma::uword(NEIGHBORS_PER_PERPLEXITY * perplexity),
+                             n > 0 ? n - 1 : 0);
+    arma::umat nn;
+    arma::mat D;
+    mp::knnGraph(X, k, nn, D);
+    k = nn.n_rows;
+    D = arma::square(D);
+
+    arma::mat Pk(k, n);
+    int nInt = uintToInt<arma::uword, int>(n);
+    double logU = log(perplexity);
+
+    #pragma omp parallel shared(D, Pk, nInt, logU, tol)
+    {
+        arma::rowvec Di(k), Pi(k);
+
+        #pragma omp for
+        for (int i = 0; i < nInt; i++) {
+            // exp(-beta D) underflows for large distances; shifting D changes
+            // neither the normalized P nor the entropy
+            Di = D.col(i).t();
+            if (k > 0) {
+                Di -= Di.min();
+            }
+
+            double beta = 1;
+            double betaMin = -arma::datum::inf;
+            double betaMax =  arma::datum::inf;
+            double h = hBeta(Di, beta, Pi);
+
+            double hDiff = h - logU;
+            for (int tries = 0; fabs(hDiff) > tol && tries < MAX_BINSEARCH_TRIES; tries++) {
+                if (hDiff > 0) {
+                    betaMin = beta;
+                    if (betaMax == arma::datum::inf || betaMax == -arma::datum::inf) {
+                        beta *= 2;
+                    } else {
+                        beta = (beta + betaMax) / 2.;
+                    }
+                } else {
+                    betaMax = beta;
+                    if (betaMin == arma::datum::inf || betaMin == -arma::datum::inf) {
+                        beta /= 2;
+                    } else {
+                        beta = (beta + betaMin) / 2.;
+                    }
+                }
+
+                h = hBeta(Di, beta, Pi);
+                hDiff = h - logU;
+            }
+
+            Pk.col(i) = Pi.t();
+        }
+    }
+
+    arma::umat locations(2, n * k);
+    arma::vec values(n * k);
+    for (arma::uword i = 0, e = 0; i < n; i++) {
+        for (arma::uword l = 0; l < k; l++, e++) {
+            locations(0, e) = nn(l, i);
+            locations(1, e) = i;
+            values[e] = Pk(l, i);
+        }
+    }
+
+    P = arma::sp_mat(locations, values, n, n);
+    P = P + P.t();
+    double sum = arma::accu(P);
+    if (sum > 0) {
+        P /= sum;
+    }
+}
@@ -0,0 +1,195 @@
+#include "vptree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "mp.h"
+#include "utils.h"
+
+// Vantage points are chosen at random, but trees should be reproducible
+static const unsigned int RNG_SEED = 123;
+
+mp::VPTree::VPTree()
+{
+}
+
+mp::VPTree::VPTree(const arma::mat &X)
+{
+    build(X);
+}
+
+void mp::VPTree::build(const arma::mat &X)
+{
+    m_points = X.t();
+    m_nodes.clear();
+    m_nodes.reserve(X.n_rows);
+
+    std::vector<HeapItem> items(X.n_rows);
+    for (arma::uword i = 0; i < X.n_rows; i++) {
+        items[i] = HeapItem(0, i);
+    }
+
+    std::mt19937 rng(RNG_SEED);
+    buildNode(items, 0, items.size(), rng);
+}
+
+double mp::VPTree::dist(const double *q, arma::uword i) const
+{
+    const double *p = m_points.colptr(i);
+    double sum = 0;
+    for (arma::uword k = 0; k < m_points.n_rows; k++) {
+        sum += (p[k] - q[k]) * (p[k] - q[k]);
+    }
+
+    return sqrt(sum);
+}
+
+int mp::VPTree::buildNode(std::vector<HeapItem> &items,
+                          arma::uword lo,
+                          arma::uword hi,
+                          std::mt19937 &rng)
+{
+    if (lo >= hi) {
+        return -1;
+    }
+
+    std::uniform_int_distribution<arma::uword> pick(lo, hi - 1);
+    std::swap(items[lo], items[pick(rng)]);
+
+    int node = m_nodes.size();
+    Node vp = { items[lo].second, 0, -1, -1 };
+    m_nodes.push_back(vp);
+    if (hi - lo == 1) {
+        return node;
+    }
+
+    // Points closer than the median distance to the vantage point go inside
+    const double *q = m_points.colptr(vp.index);
+    for (arma::uword i = lo + 1; i < hi; i++) {
+        items[i].first = dist(q, items[i].second);
+    }
+
+    arma::uword median = (lo + 1 + hi) / 2;
+    std::nth_element(items.begin() + lo + 1,
+                     items.begin() + median,
+                     items.begin() + hi);
+    m_nodes[node].threshold = items[median].first;
+
+    int inside = buildNode(items, lo + 1, median, rng);
+    int outside = buildNode(items, median, hi, rng);
+    m_nodes[node].inside = inside;
+    m_nodes[node].outside = outside;
+    return node;
+}
+
+void mp::VPTree::search(int node,
+                        const double *q,
+                        arma::uword k,
+                        std::vector<HeapItem> &heap,
+                        double &tau) const
+{
+    if (node < 0) {
+        return;
+    }
+
+    const Node &vp = m_nodes[node];
+    double d = dist(q, vp.index);
+    if (d < tau) {
+        heap.push_back(HeapItem(d, vp.index));
+        std::push_heap(heap.begin(), heap.end());
+        if (heap.size() > k) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+        if (heap.size() == k) {
+            tau = heap.front().first;
+        }
+    }
+
+    if (d < vp.threshold) {
+        if (d - tau <= vp.threshold) {
+            search(vp.inside, q, k, heap, tau);
+        }
+        if (d + tau >= vp.threshold) {
+            search(vp.outside, q, k, heap, tau);
+        }
+    } else {
+        if (d + tau >= vp.threshold) {
+            search(vp.outside, q, k, heap, tau);
+        }
+        if (d - tau <= vp.threshold) {
+            search(vp.inside, q, k, heap, tau);
+        }
+    }
+}
+
+void mp::VPTree::knn(const double *q, arma::uword k, arma::uword *nn, double *dist) const
+{
+    if (k == 0) {
+        return;
+    }
+
+    std::vector<HeapItem> heap;
+    heap.reserve(k + 1);
+    double tau = std::numeric_limits<double>::infinity();
+    search(m_nodes.empty() ? -1 : 0, q, k, heap, tau);
+
+    std::sort_heap(heap.begin(), heap.end());
+    for (arma::uword i = 0; i < heap.size(); i++) {
+        dist[i] = heap[i].first;
+        nn[i] = heap[i].second;
+    }
+}
+
+void mp::VPTree::knn(const arma::rowvec &q, arma::uword k, arma::uvec &nn, arma::vec &dist) const
+{
+    k = std::min(k, size());
+    nn.set_size(k);
+    dist.set_size(k);
+    knn(q.memptr(), k, nn.memptr(), dist.memptr());
+}
+
+void mp::VPTree::knnGraph(arma::uword k, arma::umat &nn, arma::mat &dist) const
+{
+    k = std::min(k, size() > 0 ? size() - 1 : 0);
+    nn.set_size(k, size());
+    dist.set_size(k, size());
+
+    int n = uintToInt<arma::uword, int>(size());
+
+    #pragma omp parallel shared(k, nn, dist, n)
+    {
+        // Point i is (usually) its own nearest neighbor, so one more is needed
+        arma::uvec neighbors(k + 1);
+        arma::vec neighborsDist(k + 1);
+
+        #pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < n; i++) {
+            knn(m_points.colptr(i), k + 1, neighbors.memptr(), neighborsDist.memptr());
+
+            // With duplicate points, i may not even be among the results
+            arma::uword self = k;
+            for (arma::uword l = 0; l <= k; l++) {
+                if (neighbors[l] == arma::uword(i)) {
+                    self = l;
+                    break;
+                }
+            }
+
+            for (arma::uword l = 0, m = 0; l <= k; l++) {
+                if (l != self) {
+                    nn(m, i) = neighbors[l];
+                    dist(m, i) = neighborsDist[l];
+                    m++;
+                }
+            }
+        }
+    }
+}
+
+void mp::knnGraph(const arma::mat &X, arma::uword k, arma::umat &nn, arma::mat &dist)
+{
+    VPTree tree(X);
+    tree.knnGraph(k, nn, dist);
+}
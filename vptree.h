@@ -0,0 +1,63 @@
+#ifndef VPTREE_H
+#define VPTREE_H
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <armadillo>
+
+namespace mp {
+
+/*
+ * A vantage-point tree over the rows of a matrix, answering exact k nearest
+ * neighbors queries (Euclidean distance) in high-dimensional spaces.
+ */
+class VPTree
+{
+public:
+    VPTree();
+    VPTree(const arma::mat &X);
+
+    void build(const arma::mat &X);
+
+    arma::uword size() const { return m_points.n_cols; }
+
+    // The k nearest rows of X to q (a pointer to X.n_cols values), ordered by
+    // increasing distance; nn and dist must hold at least k elements
+    void knn(const double *q, arma::uword k, arma::uword *nn, double *dist) const;
+    void knn(const arma::rowvec &q, arma::uword k, arma::uvec &nn, arma::vec &dist) const;
+
+    // kNN graph of the indexed points themselves: column i of nn (and dist)
+    // holds the k nearest neighbors of point i other than itself, nearest
+    // first. Points are queried in parallel.
+    void knnGraph(arma::uword k, arma::umat &nn, arma::mat &dist) const;
+
+private:
+    struct Node {
+        arma::uword index;
+        double threshold;
+        int inside, outside;
+    };
+
+    typedef std::pair<double, arma::uword> HeapItem;
+
+    int buildNode(std::vector<HeapItem> &items,
+                  arma::uword lo,
+                  arma::uword hi,
+                  std::mt19937 &rng);
+    void search(int node,
+                const double *q,
+                arma::uword k,
+                std::vector<HeapItem> &heap,
+                double &tau) const;
+    double dist(const double *q, arma::uword i) const;
+
+    // One point per column, so each point is contiguous in memory
+    arma::mat m_points;
+    std::vector<Node> m_nodes;
+};
+
+} // namespace mp
+
+#endif // VPTREE_H